@@ -0,0 +1,189 @@
+//
+// Created by kiron on 6/2/25.
+//
+
+#include "buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+RowBuffer* createRowBuffer(int size) {
+    //Creates a new, empty row buffer on the heap
+    RowBuffer* buffer = malloc(sizeof(RowBuffer));
+    if (size < 1) {
+        size = 1;
+    }
+    buffer->capacity = size;
+    buffer->gap_start = 0;
+    buffer->gap_end = size;
+    buffer->epoch = 0;
+    buffer->frozen_epoch = -1;
+    buffer->readers = 0;
+    buffer->retired = NULL;
+    buffer->retired_count = 0;
+    buffer->retired_capacity = 0;
+    buffer->rows = malloc(size * sizeof(erow));
+    if (!buffer->rows) {
+        exit(EXIT_FAILURE);
+    }
+    return buffer;
+}
+
+void destroyRowBuffer(RowBuffer* buffer) {
+    //Deallocates the row array, the rows contents are owned by the editor
+    while (buffer->readers) {
+        releaseRows(buffer);
+    }
+    free(buffer->retired);
+    free(buffer->rows);
+    free(buffer);
+}
+
+int rowCount(RowBuffer* buffer) {
+    //Returns the number of rows stored in the buffer
+    return buffer->capacity - (buffer->gap_end - buffer->gap_start);
+}
+
+erow* getRow(RowBuffer* buffer, int at) {
+    //Returns the row at a position, skipping over the gap
+    if (at >= buffer->gap_start) {
+        at += buffer->gap_end - buffer->gap_start;
+    }
+    return &buffer->rows[at];
+}
+
+int getRowIndex(RowBuffer* buffer, erow* row) {
+    //Returns the position of a row in the file from its place in the array
+    int at = row - buffer->rows;
+    if (at >= buffer->gap_end) {
+        at -= buffer->gap_end - buffer->gap_start;
+    }
+    return at;
+}
+
+void moveGap(RowBuffer* buffer, int at) {
+    //Moves the gap so it starts at position at, only the rows between the old and new gap are moved
+    int gapSize = buffer->gap_end - buffer->gap_start;
+    if (at < buffer->gap_start) {
+        memmove(&buffer->rows[at + gapSize], &buffer->rows[at],
+            sizeof(erow) * (buffer->gap_start - at));
+    } else if (at > buffer->gap_start) {
+        memmove(&buffer->rows[buffer->gap_start], &buffer->rows[buffer->gap_end],
+            sizeof(erow) * (at - buffer->gap_start));
+    }
+    buffer->gap_start = at;
+    buffer->gap_end = at + gapSize;
+}
+
+void growGap(RowBuffer* buffer) {
+    //Doubles the capacity of the buffer, the new space is added to the gap
+    int newCapacity = buffer->capacity * 2;
+    int tail = buffer->capacity - buffer->gap_end;
+    erow* rows = realloc(buffer->rows, newCapacity * sizeof(erow));
+    if (!rows) {
+        exit(EXIT_FAILURE);
+    }
+    memmove(&rows[newCapacity - tail], &rows[buffer->gap_end], sizeof(erow) * tail);
+    buffer->rows = rows;
+    buffer->gap_end = newCapacity - tail;
+    buffer->capacity = newCapacity;
+}
+
+erow* insertRow(RowBuffer* buffer, int at) {
+    //Makes space for a new row at a position and returns it, the row has to be filled in by the caller
+    if (buffer->gap_start == buffer->gap_end) {
+        growGap(buffer);
+    }
+    moveGap(buffer, at);
+    return &buffer->rows[buffer->gap_start++];
+}
+
+void deleteRow(RowBuffer* buffer, int at) {
+    //Removes a row from the buffer, the rows contents have to be freed by the caller first
+    moveGap(buffer, at);
+    buffer->gap_end++;
+}
+
+int isRowFrozen(RowBuffer* buffer, erow* row) {
+    //Returns 1 when the text of a row may be read by a snapshot and can not be changed in place
+    return row->capacity && row->epoch <= buffer->frozen_epoch;
+}
+
+void retireChars(RowBuffer* buffer, char* chars) {
+    //Keeps frozen text alive until the rows are released
+    if (buffer->retired_count == buffer->retired_capacity) {
+        buffer->retired_capacity = buffer->retired_capacity ? buffer->retired_capacity * 2 : 64;
+        buffer->retired = realloc(buffer->retired, buffer->retired_capacity * sizeof(char*));
+        if (!buffer->retired) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    buffer->retired[buffer->retired_count++] = chars;
+}
+
+void reserveRowChars(RowBuffer* buffer, erow* row, int size) {
+    //Makes sure a row can hold size characters plus the null terminator, grows the row geometrically
+    //Rows without a capacity point at text they do not own, they are copied before being changed, as is frozen text
+    if (size < row->size) {
+        size = row->size;
+    }
+    int frozen = isRowFrozen(buffer, row);
+    if (size + 1 <= row->capacity && !frozen) {
+        return;
+    }
+    int newCapacity = row->capacity ? row->capacity : 16;
+    while (newCapacity < size + 1) {
+        newCapacity *= 2;
+    }
+    char* chars;
+    if (row->capacity && !frozen) {
+        chars = realloc(row->chars, newCapacity);
+    } else {
+        chars = malloc(newCapacity);
+        if (chars && row->size) {
+            memcpy(chars, row->chars, row->size);
+        }
+        if (frozen) {
+            retireChars(buffer, row->chars);
+        }
+    }
+    if (!chars) {
+        exit(EXIT_FAILURE);
+    }
+    chars[row->size] = '\0';
+    row->chars = chars;
+    row->capacity = newCapacity;
+    row->epoch = buffer->epoch;
+}
+
+void freeRowChars(RowBuffer* buffer, erow* row) {
+    //Frees the text owned by a row, frozen text is retired instead
+    if (!row->capacity) {
+        return;
+    }
+    if (isRowFrozen(buffer, row)) {
+        retireChars(buffer, row->chars);
+    } else {
+        free(row->chars);
+    }
+}
+
+void freezeRows(RowBuffer* buffer) {
+    //Freezes the text of every row as it is now for one more reader, text allocated after this is not frozen
+    buffer->frozen_epoch = buffer->epoch++;
+    buffer->readers++;
+}
+
+void releaseRows(RowBuffer* buffer) {
+    //Releases the rows for one reader, once the last reader is done the rows are unfrozen
+    //and the text that was retired while they were frozen is freed
+    if (buffer->readers == 0 || --buffer->readers > 0) {
+        return;
+    }
+    int i;
+    for (i = 0; i < buffer->retired_count; i++) {
+        free(buffer->retired[i]);
+    }
+    buffer->retired_count = 0;
+    buffer->frozen_epoch = -1;
+}
@@ -0,0 +1,65 @@
+//
+// Created by kiron on 6/2/25.
+//
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+//Structure of a row of text
+//Rows do not store their own position, it is found from where the row sits in the buffer
+//hl_state is the lexer state at the end of the row, a checkpoint used to highlight the rows after it
+//hl_start and hl_generation record the state and syntax the highlight was made with
+//The highlight is kept as runs of render characters of one color each, one after another from the start
+//of the row, the characters after the last run are normal
+
+struct hlSpan {
+    unsigned short length;
+    unsigned char hl;
+};
+
+typedef struct erow {
+    int size;
+    int capacity;
+    int epoch;
+    int rsize;
+    int indent;
+    char* chars;
+    char* render;
+    struct hlSpan* spans;
+    int span_count;
+    int hl_state;
+    int hl_start;
+    int hl_generation;
+} erow;
+
+//Line indexed gap buffer storing every row of the file
+//Rows before gap_start are stored at the front of the array, the rest are stored after gap_end, so
+//inserting or deleting rows near the last edit only moves the gap and not the whole file
+
+//Row text can be frozen while other threads read it, row text is stamped with the epoch it was
+//allocated in, and text from the frozen epoch or older is copied before being changed
+//Each reader freezes and releases the rows once, text replaced or deleted while frozen is retired
+//and only freed once every reader has released the rows
+
+typedef struct RowBuffer {
+    erow* rows;
+    int gap_start, gap_end, capacity;
+    int epoch, frozen_epoch, readers;
+    char** retired;
+    int retired_count, retired_capacity;
+} RowBuffer;
+
+RowBuffer* createRowBuffer(int size);
+void destroyRowBuffer(RowBuffer* buffer);
+int rowCount(RowBuffer* buffer);
+erow* getRow(RowBuffer* buffer, int at);
+int getRowIndex(RowBuffer* buffer, erow* row);
+erow* insertRow(RowBuffer* buffer, int at);
+void deleteRow(RowBuffer* buffer, int at);
+void reserveRowChars(RowBuffer* buffer, erow* row, int size);
+void freeRowChars(RowBuffer* buffer, erow* row);
+void freezeRows(RowBuffer* buffer);
+void releaseRows(RowBuffer* buffer);
+
+
+#endif //BUFFER_H
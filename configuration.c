@@ -3,6 +3,196 @@
 //
 #include "configuration.h"
 
+#include <ctype.h>
+
+int isSeperator(int c) {
+    //Determines if a character is a non-highlightable character
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=-~%<>[];:", c) != NULL;
+}
+
+void initKeywordTrie(struct keywordTrie* trie) {
+    //Sets up an empty trie, only the root node exists and no characters have a class yet
+    memset(trie->classes, 0, sizeof(trie->classes));
+    trie->classCount = 0;
+    trie->nodeCount = 1;
+    trie->nodeCapacity = 1;
+    trie->nodes = malloc(sizeof(struct keywordNode));
+    trie->nodes[0].type = KW_NONE;
+    trie->nodes[0].order = 0;
+    trie->next = NULL;
+}
+
+void freeKeywordTrie(struct keywordTrie* trie) {
+    //Deallocates the nodes and transitions of a trie
+    free(trie->nodes);
+    free(trie->next);
+}
+
+int addKeywordNode(struct keywordTrie* trie) {
+    //Adds a node without transitions and returns its index, nodes and transitions grow geometrically
+    if (trie->nodeCount == trie->nodeCapacity) {
+        trie->nodeCapacity *= 2;
+        trie->nodes = realloc(trie->nodes, trie->nodeCapacity * sizeof(struct keywordNode));
+        trie->next = realloc(trie->next, trie->nodeCapacity * trie->classCount * sizeof(int));
+    }
+    int node = trie->nodeCount++;
+    trie->nodes[node].type = KW_NONE;
+    trie->nodes[node].order = 0;
+    memset(&trie->next[node * trie->classCount], 0, trie->classCount * sizeof(int));
+    return node;
+}
+
+void compileKeywords(struct keywordTrie* trie, char** keywords, int count) {
+    //Builds the trie from the keywords in the order they were listed, a pipe at the end makes a keyword2
+    //order remembers the position of each keyword, when two keywords match the first listed one is used
+    freeKeywordTrie(trie);
+    initKeywordTrie(trie);
+    int i, k;
+    for (i = 0; i < count; i++) {
+        int length = strlen(keywords[i]);
+        if (keywords[i][length - 1] == '|') {
+            length--;
+        }
+        for (k = 0; k < length; k++) {
+            unsigned char c = keywords[i][k];
+            if (!trie->classes[c]) {
+                trie->classes[c] = ++trie->classCount;
+            }
+        }
+    }
+    trie->next = calloc(trie->nodeCapacity * trie->classCount + 1, sizeof(int));
+
+    for (i = 0; i < count; i++) {
+        int length = strlen(keywords[i]);
+        int type = KW_KEYWORD1;
+        if (keywords[i][length - 1] == '|') {
+            length--;
+            type = KW_KEYWORD2;
+        }
+        int node = 0;
+        for (k = 0; k < length; k++) {
+            int transition = node * trie->classCount + trie->classes[(unsigned char) keywords[i][k]] - 1;
+            if (!trie->next[transition]) {
+                int child = addKeywordNode(trie);
+                trie->next[transition] = child;
+            }
+            node = trie->next[transition];
+        }
+        if (trie->nodes[node].type == KW_NONE) {
+            trie->nodes[node].type = type;
+            trie->nodes[node].order = i;
+        }
+    }
+}
+
+int startsWith(char* delimiter, unsigned char c) {
+    //Returns 1 when a comment delimiter is set and starts with the character
+    return delimiter && delimiter[0] && (unsigned char) delimiter[0] == c;
+}
+
+void compileLexer(struct editorSyntax* syntax) {
+    //Compiles the comments, flags and keywords of a syntax into the lexer transition table
+    struct lexTable* lexer = &syntax->lexer;
+    struct keywordTrie* trie = &syntax->keywords;
+    int hasSlc = syntax->singleLineCommentStart && syntax->singleLineCommentStart[0];
+    int hasMlc = syntax->multiLineCommentStart && syntax->multiLineCommentStart[0] &&
+        syntax->multiLineCommentEnd && syntax->multiLineCommentEnd[0];
+    int strings = syntax->flags & HL_HIGHLIGHT_STRINGS;
+    int numbers = syntax->flags & HL_HIGHLIGHT_NUMBERS;
+
+    //Gives every byte a signature of everything the lexer checks about it, equal signatures share a class
+    int signatures[256];
+    int classSignature[256];
+    int c, k;
+    lexer->classCount = 0;
+    for (c = 0; c < 256; c++) {
+        int keywordClass = trie->classes[c];
+        int signature = (isSeperator(c) ? 1 : 0) |
+            (isdigit(c) ? 2 : 0) |
+            (c == '.' ? 4 : 0) |
+            (c == '\'' ? 8 : 0) |
+            (c == '"' ? 16 : 0) |
+            (c == '\\' ? 32 : 0) |
+            (hasSlc && startsWith(syntax->singleLineCommentStart, c) ? 64 : 0) |
+            (hasMlc && startsWith(syntax->multiLineCommentStart, c) ? 128 : 0) |
+            (hasMlc && startsWith(syntax->multiLineCommentEnd, c) ? 256 : 0) |
+            (trie->nodes[0].type != KW_NONE || (keywordClass && trie->next[keywordClass - 1]) ? 512 : 0);
+        for (k = 0; k < lexer->classCount && classSignature[k] != signature; k++);
+        if (k == lexer->classCount) {
+            classSignature[lexer->classCount++] = signature;
+        }
+        lexer->classes[c] = k;
+        signatures[c] = signature;
+    }
+
+    free(lexer->actions);
+    lexer->actions = calloc(LEX_STATES * lexer->classCount, sizeof(struct lexAction));
+    for (c = 0; c < 256; c++) {
+        int signature = signatures[c];
+        int state;
+        for (state = 0; state < LEX_STATES; state++) {
+            struct lexAction* action = &lexer->actions[state * lexer->classCount + lexer->classes[c]];
+            action->delimiters = 0;
+            action->keyword = 0;
+            if (state == LEX_COMMENT) {
+                action->delimiters = (signature & 256) ? LEX_MLC_END : 0;
+                action->hl = HL_MULTILINE_COMMENT;
+                action->next = LEX_COMMENT;
+            } else if (state == LEX_SINGLE_QUOTE || state == LEX_DOUBLE_QUOTE) {
+                int quote = (state == LEX_SINGLE_QUOTE) ? '\'' : '"';
+                action->hl = HL_STRING;
+                if (c == '\\') {
+                    action->next = (state == LEX_SINGLE_QUOTE) ? LEX_SINGLE_ESCAPE : LEX_DOUBLE_ESCAPE;
+                } else {
+                    action->next = (c == quote) ? LEX_SEP : state;
+                }
+            } else if (state == LEX_SINGLE_ESCAPE || state == LEX_DOUBLE_ESCAPE) {
+                action->hl = HL_STRING;
+                action->next = (state == LEX_SINGLE_ESCAPE) ? LEX_SINGLE_QUOTE : LEX_DOUBLE_QUOTE;
+            } else {
+                //Comments are checked first, then strings, numbers, keywords and plain characters
+                action->delimiters = ((signature & 64) ? LEX_SLC : 0) | ((signature & 128) ? LEX_MLC_START : 0);
+                if (strings && (c == '\'' || c == '"')) {
+                    action->hl = HL_STRING;
+                    action->next = (c == '\'') ? LEX_SINGLE_QUOTE : LEX_DOUBLE_QUOTE;
+                } else if (numbers && (((signature & 2) && state != LEX_WORD) ||
+                    (c == '.' && state == LEX_NUMBER))) {
+                    action->hl = HL_NUMBER;
+                    action->next = LEX_NUMBER;
+                } else {
+                    action->keyword = (state == LEX_SEP && (signature & 512));
+                    action->hl = HL_NORMAL;
+                    action->next = (signature & 1) ? LEX_SEP : LEX_WORD;
+                }
+            }
+        }
+    }
+
+    //Finds the states that only stop on one or two bytes
+    int state;
+    for (state = 0; state < LEX_STATES; state++) {
+        int stopCount = 0;
+        int hl = -1;
+        for (c = 0; c < 256; c++) {
+            struct lexAction* action = &lexer->actions[state * lexer->classCount + lexer->classes[c]];
+            if (hl == -1 && action->next == state && !action->delimiters && !action->keyword) {
+                hl = action->hl;
+            }
+            if (action->next != state || action->delimiters || action->keyword || action->hl != hl) {
+                if (stopCount < 2) {
+                    lexer->stops[state][stopCount] = c;
+                }
+                stopCount++;
+            }
+        }
+        lexer->runs[state] = (stopCount > 0 && stopCount <= 2);
+        lexer->runHl[state] = (hl == -1) ? HL_NORMAL : hl;
+        if (stopCount == 1) {
+            lexer->stops[state][1] = lexer->stops[state][0];
+        }
+    }
+}
+
 void loadFileType(struct editorSyntax* syntax, char* line) {
     //Loads all information about each filetype into a syntax structure
     char* token = strtok(line, "=");
@@ -29,24 +219,26 @@ void loadFileType(struct editorSyntax* syntax, char* line) {
                 syntax->filematch = tmp;
             }
         }
-        syntax->filematchSize = size;
+        syntax->filematch[exC] = NULL;
+        syntax->filematchSize = exC;
 
     } else if (!strcmp(token, "KEYWORDS")) {
+        //The keywords point into the line, they are only needed until the trie is built
         char* keyword;
         int exC = 0;
         int size = 2;
-        syntax->keywords = malloc(size * sizeof(char*));
+        char** keywords = malloc(size * sizeof(char*));
         while ((keyword = strtok(NULL, ","))) {
-            syntax->keywords[exC] = malloc(strlen(keyword) + 1);
-            strcpy(syntax->keywords[exC], keyword);
+            keywords[exC] = keyword;
             exC++;
             if (exC == size) {
                 size *= 2;
-                char** tmp = realloc(syntax->keywords, size * sizeof(char*));
-                syntax->keywords = tmp;
+                char** tmp = realloc(keywords, size * sizeof(char*));
+                keywords = tmp;
             }
         }
-        syntax->keywordSize = size;
+        compileKeywords(&syntax->keywords, keywords, exC);
+        free(keywords);
 
     } else if (!strcmp(token, "SLC")) {
         char* slc = strtok(NULL, "=");
@@ -102,10 +294,8 @@ void freeSyntax(struct editorSyntax* syntax) {
         free(syntax->filematch[i]);
     }
     free(syntax->filematch);
-    for (i = 0; i < syntax->keywordSize; i++) {
-        free(syntax->keywords[i]);
-    }
-    free(syntax->keywords);
+    freeKeywordTrie(&syntax->keywords);
+    free(syntax->lexer.actions);
     free(syntax->singleLineCommentStart);
     free(syntax->multiLineCommentStart);
     free(syntax->multiLineCommentEnd);
@@ -169,12 +359,18 @@ void loadConfig(struct Configuration* config) {
             isLoadingFileType = 1;
             syntax = malloc(sizeof(struct editorSyntax));
             syntax->flags = 0;
+            syntax->singleLineCommentStart = NULL;
+            syntax->multiLineCommentStart = NULL;
+            syntax->multiLineCommentEnd = NULL;
+            syntax->lexer.actions = NULL;
+            initKeywordTrie(&syntax->keywords);
             continue;
         }
         if (!strcmp(token, "[FEnd]")) {
             //End allocating syntax and add to the end of the syntax linked list
             isLoadingFileType = 0;
             syntax->next = NULL;
+            compileLexer(syntax);
             if (!config->syntax) {
                 config->syntax = syntax;
             } else {
@@ -203,6 +399,12 @@ void loadConfig(struct Configuration* config) {
                 config->default_undo = value;
             } else if (!strcmp(token, "INF_UNDO")) {
                 config->inf_undo = value;
+            } else if (!strcmp(token, "UNDO_MEMORY")) {
+                config->undo_memory = value;
+            } else if (!strcmp(token, "UNDO_HISTORY")) {
+                config->undo_history = value;
+            } else if (!strcmp(token, "UNDO_HISTORY_SIZE")) {
+                config->undo_history_size = value;
             } else if (!strcmp(token, "CURSOR_SAVE")) {
                 config->cursor_save = value;
             } else if (!strcmp(token, "USE_256_COLORS")) {
@@ -12,22 +12,97 @@
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
 
+#define KW_NONE 0
+#define KW_KEYWORD1 1
+#define KW_KEYWORD2 2
+
+#define LEX_SLC (1<<0)
+#define LEX_MLC_START (1<<1)
+#define LEX_MLC_END (1<<2)
+
+enum editorHighlight {
+    HL_NORMAL = 0,
+    HL_NUMBER,
+    HL_STRING,
+    HL_COMMENT,
+    HL_MULTILINE_COMMENT,
+    HL_KEYWORD1,
+    HL_KEYWORD2,
+    HL_MATCH
+};
+
+//States of the table driven lexer, a row starts in LEX_SEP or in LEX_COMMENT when a comment is still open
+//LEX_SEP follows a separator, LEX_WORD any other character and LEX_NUMBER a highlighted number
+
+enum lexState {
+    LEX_SEP = 0,
+    LEX_WORD,
+    LEX_NUMBER,
+    LEX_COMMENT,
+    LEX_SINGLE_QUOTE,
+    LEX_DOUBLE_QUOTE,
+    LEX_SINGLE_ESCAPE,
+    LEX_DOUBLE_ESCAPE,
+    LEX_STATES
+};
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+//Keywords of a syntax compiled into a trie, so finding the keyword at a position only reads its characters once
+//Only bytes used by some keyword get a character class, each node has one transition per class
+//A transition of 0 means no keyword continues with that character, the root is never a target
+
+struct keywordNode {
+    int type;
+    int order;
+};
+
+struct keywordTrie {
+    unsigned char classes[256];
+    int classCount;
+    int nodeCount;
+    int nodeCapacity;
+    struct keywordNode* nodes;
+    int* next;
+};
+
+//Syntax compiled into a transition table, bytes that behave the same share a class
+//Each state and class has one action giving the highlight of the byte and the next state
+//delimiters lists the comment delimiters that may start at the byte and keyword says a keyword may start there,
+//both are checked before the action is taken
+//States where at most two bytes do anything but continue the state (comments, strings) have a run,
+//the lexer skips to the next of those stop bytes with a vector scan and fills the bytes before it with runHl
+
+struct lexAction {
+    unsigned char next;
+    unsigned char hl;
+    unsigned char delimiters;
+    unsigned char keyword;
+};
+
+struct lexTable {
+    unsigned char classes[256];
+    int classCount;
+    struct lexAction* actions;
+    unsigned char runs[LEX_STATES];
+    unsigned char runHl[LEX_STATES];
+    char stops[LEX_STATES][2];
+};
+
 //Editor syntax structure to store a syntax used for highlighting text in files supporting this syntax
 
 struct editorSyntax {
     char* filetype;
     char** filematch;
-    char** keywords;
+    struct keywordTrie keywords;
     char* singleLineCommentStart;
     char* multiLineCommentStart;
     char* multiLineCommentEnd;
     int flags;
+    struct lexTable lexer;
     int filematchSize;
-    int keywordSize;
     struct editorSyntax* next;
 };
 
@@ -39,6 +114,9 @@ struct Configuration {
     int auto_indent;
     int default_undo;
     int inf_undo;
+    int undo_memory;
+    int undo_history;
+    int undo_history_size;
     int cursor_save;
     int use_256_colors;
     int hl_number;
@@ -53,6 +131,9 @@ struct Configuration {
     int highlight_entries;
 };
 
+int isSeperator(int c);
+void initKeywordTrie(struct keywordTrie* trie);
+void compileLexer(struct editorSyntax* syntax);
 void loadFileType(struct editorSyntax* syntax, char* line);
 void setColorHighlights(struct Configuration* config, char* token, int value);
 void loadConfig(struct Configuration* config);
@@ -45,14 +45,35 @@
 #include <termios.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <string.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
+#include <poll.h>
+#include <signal.h>
 #include "configuration.h"
 #include "stack.h"
+#include "undo.h"
+#include "buffer.h"
+#include "scan.h"
+#include "screen.h"
 
 #define CTRL_KEY(k) ((k) & 0x1f)
 #define KEWETEXT_VERSION "1.0.2"
+#define HL_SYNC_ROWS 4096
+#define HL_JOB_ROWS 65536
+#define LOAD_BATCH_LINES 4096
+#define LOAD_SYNC_ROWS 16384
+#define LOAD_STAGED_LINES (LOAD_SYNC_ROWS * 16)
+#define FRAME_INTERVAL_MS 16
+#define PROGRESS_INTERVAL_MS 100
+#define INPUT_BUFFER_SIZE 4096
+#define ESCAPE_TIMEOUT_MS 100
+#define PASTE_TIMEOUT_MS 1000
 
 struct Configuration config;
 
@@ -71,36 +92,26 @@ enum editorKey {
     PAGE_DOWN,
     HOME,
     END,
-    BACKNEWROW,
-    DELETEINV
+    NO_KEY,
+    PASTE
 };
 
-enum editorHighlight {
-    HL_NORMAL = 0,
-    HL_NUMBER,
-    HL_STRING,
-    HL_COMMENT,
-    HL_MULTILINE_COMMENT,
-    HL_KEYWORD1,
-    HL_KEYWORD2,
-    HL_MATCH
+//Kinds of edits that are undone together when done one after another, GROUP_ALONE is always undone by itself
+enum editorUndoGroup {
+    GROUP_ALONE = 0,
+    GROUP_TYPING,
+    GROUP_BACKSPACE,
+    GROUP_DELETE
 };
 
-
-//DATA
+//State the lexer is in at the end of a row, carried into the next row
+enum editorLexState {
+    HL_STATE_NORMAL = 0,
+    HL_STATE_COMMENT
+};
 
 
-//Structure of a row of text
-typedef struct erow {
-    int index;
-    int size;
-    int rsize;
-    int indent;
-    char* chars;
-    char* render;
-    unsigned char* highlight;
-    int hl_open_comment;
-} erow;
+//DATA
 
 //Stores original terminal settings
 struct editorConfig {
@@ -115,12 +126,32 @@ struct editorConfig {
     int dirty;
     int help;
     int state;
-    erow* row;
+    RowBuffer* rows;
+    char* map;
+    size_t map_size;
+    int loading;
+    int load_percent;
+    int load_pending;
+    int saving;
+    int save_percent;
     char* filename;
     char* copied_text;
     char status[80];
     time_t status_time;
     struct editorSyntax* syntax;
+    Screen* screen;
+    int shown_rowoff;
+    int shown_coloff;
+    int hl_valid;
+    int hl_resume;
+    int hl_end;
+    int hl_target;
+    int hl_generation;
+    unsigned char* hl_scratch;
+    int hl_scratch_size;
+    int find_row;
+    int find_start;
+    int find_length;
     struct termios orig_termios;
 
     //Start included, end not included, equal startx and endx and starty and endy means no select
@@ -132,10 +163,108 @@ struct editorConfig {
 
 struct editorConfig E;
 
-Stack* undo;
-Stack* redo;
-Stack* undoPageKeysY;
-Stack* undoPageKeysX;
+//A line found by the loader thread that has not been added to the rows yet
+struct loadedLine {
+    char* text;
+    int size;
+};
+
+//Background loader that indexes the rest of the file while the editor is already running
+//Lines it found wait in a ring of LOAD_STAGED_LINES until the editor adds them, the loader waits for room when it is full
+//With hashing set it also hashes the whole file, for the undo history opened with it to be checked against
+struct editorLoader {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t staged;
+    pthread_cond_t room;
+    char* next;
+    char* end;
+    struct loadedLine* lines;
+    int head;
+    int count;
+    int done;
+    int hashing;
+    unsigned long long hash;
+};
+
+struct editorLoader loader;
+
+//Background save that writes a frozen snapshot of the rows while the editor keeps running
+//Lines of the file mapping the loader had not added yet go from tail to tail_end, the save writes them after the rows
+struct editorSaver {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+    struct iovec* pieces;
+    int count;
+    char* tail;
+    char* tail_end;
+    char* filename;
+    mode_t mode;
+    int dirty;
+    long long length;
+    long long written;
+    int hashing;
+    unsigned long long hash;
+    undoHistoryWrite history;
+    int done;
+    int result;
+    int error;
+};
+
+struct editorSaver saver;
+
+//Background highlighter that finds the lexer states of rows far from the last valid checkpoint,
+//the screen draws those rows with their last colors until the states are in
+struct editorHighlighter {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct editorSyntax* syntax;
+    struct loadedLine* rows;
+    unsigned char* states;
+    int capacity;
+    int count;
+    int start;
+    int state;
+    int limit;
+    int started;
+    int busy;
+    int done;
+};
+
+struct editorHighlighter highlighter = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+
+//Things the main loop waits on besides keys, a resize and the background threads write a byte
+//to the pipe so the loop wakes up in poll instead of checking on a timer
+struct editorEvents {
+    int pipe[2];
+    volatile sig_atomic_t resized;
+    struct timespec last_frame;
+};
+
+struct editorEvents events = {
+    .pipe = { -1, -1 }
+};
+
+//Bytes read from the terminal that are not keys yet, everything waiting is read in one go
+//A bracketed paste is collected whole into paste and handed over as a single PASTE key
+struct editorInput {
+    unsigned char buffer[INPUT_BUFFER_SIZE];
+    int start;
+    int length;
+    char* paste;
+    int paste_length;
+    int paste_capacity;
+};
+
+struct editorInput input;
+
+UndoLog* undo;
+UndoLog* redo;
 
 //PROTOTYPES
 void setStatusMessage(const char* message, ...);
@@ -143,8 +272,16 @@ void refreshScreen();
 char* editorPrompt(char* prompt, void (*callback) (char*, int));
 void moveCursor(int key);
 void moveSelect(int key, int* in_select, int* sel_dir);
-void pushArrows(Stack* stack, int key);
-void processPageKeys(Stack* stack, int c);
+void processPageKeys(int c);
+int editorSyncLoader();
+int editorSyncSaver();
+erow* editorRow(int at);
+erow* editorPrepareRow(int at);
+int editorSyncHighlighter();
+void editorQueueHighlight();
+void editorCancelHighlight(int at);
+void editorRenderRow(erow* row);
+int getWindowSize(int* rows, int* cols);
 
 //TERMINAL
 
@@ -159,6 +296,7 @@ void die(const char* error) {
 
 void disableRawMode() {
     //Disables terminals raw edit mode and returns to it's original settings
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
         die("tcsetattr");
     }
@@ -187,78 +325,325 @@ void enableRawMode() {
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) {
         die("tcsetattr");
     }
+    //Asks the terminal to mark pasted text, so a paste is not typed in as keys
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-int editorReadKey() {
-    //Reads keys from the terminal
-    int readnum;
-    char c;
-    while ((readnum = read(STDIN_FILENO, &c, 1)) != 1) {
-        if (readnum == -1 && errno != EAGAIN) {
-            die("read");
+//EVENTS
+
+void editorWake() {
+    //Wakes the main loop, safe to call from the background threads and from signal handlers
+    int error = errno;
+    if (events.pipe[1] != -1 && write(events.pipe[1], "w", 1) == -1) {
+        //A full pipe already has a wake up waiting in it
+    }
+    errno = error;
+}
+
+void handleResize(int signal) {
+    //Notes that the terminal changed size, the main loop picks up the new size
+    (void)signal;
+    events.resized = 1;
+    editorWake();
+}
+
+void startEvents() {
+    //Opens the wake up pipe and listens for the terminal being resized
+    if (pipe(events.pipe) == -1) {
+        die("pipe");
+    }
+    int i;
+    for (i = 0; i < 2; i++) {
+        fcntl(events.pipe[i], F_SETFL, fcntl(events.pipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(events.pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handleResize;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    if (sigaction(SIGWINCH, &action, NULL) == -1) {
+        die("sigaction");
+    }
+}
+
+int editorWaitEvent(int timeout) {
+    //Waits up to timeout milliseconds, or for ever when negative, for a key or a wake up
+    //Returns 1 when a key can be read
+    if (input.length > 0) {
+        return 1;
+    }
+    struct pollfd fds[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = events.pipe[0], .events = POLLIN }
+    };
+    int ready = poll(fds, 2, timeout);
+    if (ready == -1) {
+        if (errno == EINTR) {
+            return 0;
         }
+        die("poll");
     }
+    if (fds[1].revents & POLLIN) {
+        char drain[64];
+        while (read(events.pipe[0], drain, sizeof(drain)) > 0) {
+        }
+    }
+    return (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) != 0;
+}
 
-    if (c == '\x1b') {
-        //Handles the reading of escape characters like the arrow keys and esc
-        char seq[5];
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) {
-            return '\x1b';
+int editorFrameTimeLeft() {
+    //Returns the milliseconds until the next frame may be drawn
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long elapsed = (now.tv_sec - events.last_frame.tv_sec) * 1000LL +
+        (now.tv_nsec - events.last_frame.tv_nsec) / 1000000;
+    if (elapsed >= FRAME_INTERVAL_MS || elapsed < 0) {
+        return 0;
+    }
+    return FRAME_INTERVAL_MS - elapsed;
+}
+
+void editorResize() {
+    //Picks up the new size of the terminal, the whole screen is drawn again
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) {
+        return;
+    }
+    resizeScreen(E.screen, rows, cols);
+    E.screen_rows = rows - 2;
+    E.screen_cols = cols;
+}
+
+int editorSyncEvents() {
+    //Handles what the main loop was woken up for, returns 1 when the screen has to be drawn again
+    int redraw = 0;
+    if (events.resized) {
+        events.resized = 0;
+        editorResize();
+        redraw = 1;
+    }
+    redraw |= (E.loading && editorSyncLoader()) | (E.saving && editorSyncSaver()) | editorSyncHighlighter();
+    return redraw;
+}
+
+//INPUT BUFFER
+
+int editorFillInput(int timeout) {
+    //Reads every byte the terminal has waiting, waiting up to timeout milliseconds for the first
+    //Returns the number of bytes read
+    if (input.start > 0) {
+        memmove(input.buffer, &input.buffer[input.start], input.length);
+        input.start = 0;
+    }
+    if (input.length == INPUT_BUFFER_SIZE) {
+        return 0;
+    }
+    struct pollfd fd = { .fd = STDIN_FILENO, .events = POLLIN };
+    if (poll(&fd, 1, timeout) <= 0) {
+        return 0;
+    }
+    int readnum = read(STDIN_FILENO, &input.buffer[input.length], INPUT_BUFFER_SIZE - input.length);
+    if (readnum == -1) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
         }
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) {
-            return '\x1b';
+        die("read");
+    }
+    input.length += readnum;
+    return readnum;
+}
+
+int editorPeekInput(int at, int timeout) {
+    //Returns the waiting byte at an offset, reading more when needed, or -1 when it did not come in time
+    while (input.length <= at) {
+        if (!editorFillInput(timeout)) {
+            return -1;
         }
-        if (seq[0] == '[') {
-            if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) {
-                    return '\x1b';
-                }
+    }
+    return input.buffer[input.start + at];
+}
 
-                if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME;
-                        case '3': return DELETE;
-                        case '4': return END;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME;
-                        case '8': return END;
-                    }
-                }
-                if (read(STDIN_FILENO, &seq[3], 1) != 1 ||
-                    read(STDIN_FILENO, &seq[4], 1) != 1) {
-                    return '\x1b';
-                }
+void editorConsumeInput(int count) {
+    //Drops bytes that were turned into a key
+    input.start += count;
+    input.length -= count;
+    if (input.length == 0) {
+        input.start = 0;
+    }
+}
 
-                if (seq[2] == ';' && seq[3] == '3') {
-                    switch (seq[4]) {
-                        case 'A': return ALT_UP;
-                        case 'B': return ALT_DOWN;
-                        case 'C': return ALT_RIGHT;
-                        case 'D': return ALT_LEFT;
-                    }
-                }
-            } else {
-                switch (seq[1]) {
-                    case 'A': return ARROW_UP;
-                    case 'B': return ARROW_DOWN;
-                    case 'C': return ARROW_RIGHT;
-                    case 'D': return ARROW_LEFT;
-                    case 'H': return HOME;
-                    case 'F': return END;
-                }
+void editorAppendPaste(const char* text, int length) {
+    //Adds text to the paste being collected
+    if (input.paste_length + length > input.paste_capacity) {
+        int newCapacity = input.paste_capacity ? input.paste_capacity : INPUT_BUFFER_SIZE;
+        while (newCapacity < input.paste_length + length) {
+            newCapacity *= 2;
+        }
+        input.paste = realloc(input.paste, newCapacity);
+        if (!input.paste) {
+            exit(EXIT_FAILURE);
+        }
+        input.paste_capacity = newCapacity;
+    }
+    memcpy(&input.paste[input.paste_length], text, length);
+    input.paste_length += length;
+}
+
+int editorReadPaste() {
+    //Collects a bracketed paste up to its closing sequence, the text is left in input.paste
+    const char* closing = "\x1b[201~";
+    input.paste_length = 0;
+    while (1) {
+        if (input.length == 0 && !editorFillInput(PASTE_TIMEOUT_MS)) {
+            break;
+        }
+        unsigned char* bytes = &input.buffer[input.start];
+        unsigned char* escape = memchr(bytes, '\x1b', input.length);
+        int count = escape ? escape - bytes : input.length;
+        editorAppendPaste((char*) bytes, count);
+        editorConsumeInput(count);
+        if (!escape) {
+            continue;
+        }
+        //An esc only ends the paste when the rest of the closing sequence follows it
+        int i;
+        for (i = 1; i < 6 && editorPeekInput(i, PASTE_TIMEOUT_MS) == closing[i]; i++) {
+        }
+        if (i == 6) {
+            editorConsumeInput(6);
+            break;
+        }
+        editorAppendPaste(closing, 1);
+        editorConsumeInput(1);
+    }
+
+    //Terminals send line breaks in a paste as \r or \r\n, the editor splits rows on \n
+    int from, to = 0;
+    for (from = 0; from < input.paste_length; from++) {
+        if (input.paste[from] == '\r') {
+            input.paste[to++] = '\n';
+            if (from + 1 < input.paste_length && input.paste[from + 1] == '\n') {
+                from++;
             }
-        } else if (seq[0] == 'O') {
-            switch (seq[1]) {
-                case 'H': return HOME;
-                case 'F': return END;
+        } else {
+            input.paste[to++] = input.paste[from];
+        }
+    }
+    input.paste_length = to;
+    return PASTE;
+}
+
+int editorDecodeEscape() {
+    //Turns the escape sequence at the front of the input into a key
+    //A whole sequence is always dropped, sequences that are not keys become a lone esc
+    int second = editorPeekInput(1, ESCAPE_TIMEOUT_MS);
+    if (second == -1) {
+        editorConsumeInput(1);
+        return '\x1b';
+    }
+    if (second == 'O') {
+        int third = editorPeekInput(2, ESCAPE_TIMEOUT_MS);
+        editorConsumeInput(third == -1 ? 2 : 3);
+        switch (third) {
+            case 'H': return HOME;
+            case 'F': return END;
+        }
+        return '\x1b';
+    }
+    if (second != '[') {
+        editorConsumeInput(2);
+        return '\x1b';
+    }
+
+    //Control sequence of numbers split by ; ending in a final character
+    int params[2] = { 0, 0 };
+    int count = 0;
+    int at = 2;
+    int c;
+    while (1) {
+        c = editorPeekInput(at, ESCAPE_TIMEOUT_MS);
+        if (c == -1) {
+            editorConsumeInput(at);
+            return '\x1b';
+        }
+        at++;
+        if (c >= '0' && c <= '9') {
+            if (count < 2 && params[count] < 10000) {
+                params[count] = params[count] * 10 + c - '0';
             }
+        } else if (c == ';') {
+            count++;
+        } else if (c >= 0x40 && c <= 0x7e) {
+            break;
+        } else if (c < 0x20 || c > 0x3f) {
+            editorConsumeInput(at);
+            return '\x1b';
+        }
+    }
+    editorConsumeInput(at);
+
+    if (c == '~') {
+        switch (params[0]) {
+            case 1: return HOME;
+            case 3: return DELETE;
+            case 4: return END;
+            case 5: return PAGE_UP;
+            case 6: return PAGE_DOWN;
+            case 7: return HOME;
+            case 8: return END;
+            case 200: return editorReadPaste();
         }
         return '\x1b';
-    } else {
-        //All non escape characters
-        return c;
     }
+    if (count == 0) {
+        switch (c) {
+            case 'A': return ARROW_UP;
+            case 'B': return ARROW_DOWN;
+            case 'C': return ARROW_RIGHT;
+            case 'D': return ARROW_LEFT;
+            case 'H': return HOME;
+            case 'F': return END;
+        }
+    } else if (params[1] == 3) {
+        switch (c) {
+            case 'A': return ALT_UP;
+            case 'B': return ALT_DOWN;
+            case 'C': return ALT_RIGHT;
+            case 'D': return ALT_LEFT;
+        }
+    }
+    return '\x1b';
+}
+
+int editorReadKey() {
+    //Reads keys from the terminal, returns NO_KEY when the screen has to be drawn again without one
+    //While a background thread runs its progress is checked every so often, otherwise it wakes the loop itself
+    static int redraw = 0;
+    while (input.length == 0) {
+        int busy = E.loading || E.saving || highlighter.busy;
+        //Rows the loader already found are added a sync at a time, checking for keys in between
+        int ready = editorWaitEvent(E.load_pending ? 0 : busy ? PROGRESS_INTERVAL_MS : -1);
+        redraw |= editorSyncEvents();
+        if (redraw && (!E.load_pending || editorFrameTimeLeft() == 0)) {
+            //Lets the screen redraw after a resize, while the file is still loading or saving, or once highlighting catches up
+            redraw = 0;
+            return NO_KEY;
+        }
+        if (ready) {
+            editorFillInput(0);
+        }
+    }
+
+    char c = input.buffer[input.start];
+    if (c == '\x1b') {
+        //Handles the reading of escape characters like the arrow keys and esc
+        return editorDecodeEscape();
+    }
+    //All non escape characters
+    editorConsumeInput(1);
+    return c;
 }
 
 int getCursorPosition(int* rows, int* cols) {
@@ -311,136 +696,387 @@ int getWindowSize(int* rows, int* cols) {
 
 //SYNTAX HIGHLIGHTING
 
-int isSeperator(int c) {
-    //Determines if a character is a non-highlightable character
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=-~%<>[];:", c) != NULL;
+int matchKeyword(struct keywordTrie* trie, char* text, int size, int* type) {
+    //Walks the keyword trie along the text and returns the length of the keyword found there, or -1
+    //A keyword only counts when a separator or the end of the text follows it
+    int found = -1;
+    int order = 0;
+    int node = 0;
+    int length = 0;
+    while (1) {
+        struct keywordNode* kw = &trie->nodes[node];
+        if (kw->type != KW_NONE && (found == -1 || kw->order < order) &&
+            (length == size || isSeperator(text[length]))) {
+            found = length;
+            order = kw->order;
+            *type = kw->type;
+        }
+        if (length == size) {
+            break;
+        }
+        int class = trie->classes[(unsigned char) text[length]];
+        if (!class) {
+            break;
+        }
+        node = trie->next[node * trie->classCount + class - 1];
+        if (!node) {
+            break;
+        }
+        length++;
+    }
+    return found;
 }
 
-void editorUpdateSyntax(erow* row) {
-    //Updates the highlighted syntax of the editor based on the editors syntax
-    row->highlight = realloc(row->highlight, row->rsize);
-    memset(row->highlight, HL_NORMAL, row->rsize);
-
-    if (E.syntax == NULL) {
-        return;
+void fillHighlight(unsigned char* hl, int at, int type, int length) {
+    //Sets the highlight of a range of characters, does nothing when only the lexer state is wanted
+    if (hl) {
+        memset(&hl[at], type, length);
     }
-    
-    //Aliases keywords and comments syntax being used
-    char** keywords = E.syntax->keywords;
-
-    char* scs = E.syntax->singleLineCommentStart;
-    char* mcs = E.syntax->multiLineCommentStart;
-    char* mce = E.syntax->multiLineCommentEnd;
+}
 
-    int scsLength = scs ? strlen(scs) : 0;
-    int mcsLength = mcs ? strlen(mcs) : 0;
-    int mceLength = mce ? strlen(mce) : 0;
+int matchDelimiter(char* text, int size, char* delimiter) {
+    //Returns the length of a comment delimiter when the text starts with it, otherwise 0
+    int length = strlen(delimiter);
+    if (length > size || memcmp(text, delimiter, length)) {
+        return 0;
+    }
+    return length;
+}
 
-    int prevSep = 1;
-    int inString = 0;
-    int inComment = (row->index > 0 && E.row[row->index - 1].hl_open_comment);
+int editorLexRow(struct editorSyntax* syntax, char* text, int size, int state, unsigned char* hl) {
+    //Highlights text starting in a lexer state and returns the state at the end of the text
+    //The text does not have to be null terminated, hl can be NULL to only work out the state
+    //It only reads its arguments, so the highlighter thread can use it as well
+    //Each byte costs one lookup in the syntax's transition table, delimiters and keywords are only
+    //checked at bytes that can start one, and comments and strings are skipped with a vector scan
+    if (syntax == NULL) {
+        fillHighlight(hl, 0, HL_NORMAL, size);
+        return HL_STATE_NORMAL;
+    }
+    struct lexTable* lexer = &syntax->lexer;
+    int lex = (state == HL_STATE_COMMENT) ? LEX_COMMENT : LEX_SEP;
 
     int i = 0;
-    while (i < row->rsize) {
-        char c = row->render[i];
-        unsigned char prevHl = (i > 0) ? row->highlight[i - 1] : HL_NORMAL;
-
-        //Single Line Comments
-        if (scsLength && !inString && !inComment) {
-            if (!strncmp(&row->render[i], scs, scsLength)) {
-                memset(&row->highlight[i], HL_COMMENT, row->rsize - i);
+    while (i < size) {
+        if (lexer->runs[lex]) {
+            int run = scanBytes(&text[i], size - i, lexer->stops[lex][0], lexer->stops[lex][1]);
+            fillHighlight(hl, i, lexer->runHl[lex], run);
+            i += run;
+            if (i == size) {
                 break;
             }
         }
+        struct lexAction* action = &lexer->actions[lex * lexer->classCount + lexer->classes[(unsigned char) text[i]]];
 
-        //Multiline Comments
-        if (mcsLength && mceLength && !inString) {
-            if (inComment) {
-                row->highlight[i] = HL_MULTILINE_COMMENT;
-                if (!strncmp(&row->render[i], mce, mceLength)) {
-                    memset(&row->highlight[i], HL_MULTILINE_COMMENT, mceLength);
-                    i += mceLength;
-                    inComment = 0;
-                    prevSep = 1;
-                    continue;
-                } else {
-                    i++;
-                    continue;
-                }
-            } else if (!strncmp(&row->render[i], mcs, mcsLength)) {
-                memset(&row->highlight[i], HL_MULTILINE_COMMENT, mcsLength);
-                i += mcsLength;
-                inComment = 1;
+        if (action->delimiters) {
+            int length;
+            if ((action->delimiters & LEX_SLC) &&
+                matchDelimiter(&text[i], size - i, syntax->singleLineCommentStart)) {
+                fillHighlight(hl, i, HL_COMMENT, size - i);
+                break;
+            }
+            if ((action->delimiters & LEX_MLC_START) &&
+                (length = matchDelimiter(&text[i], size - i, syntax->multiLineCommentStart))) {
+                fillHighlight(hl, i, HL_MULTILINE_COMMENT, length);
+                i += length;
+                lex = LEX_COMMENT;
                 continue;
             }
-        }
-
-        //String Syntax Checking
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-            if (inString) {
-                row->highlight[i] = HL_STRING;
-                if (c == '\\' && i + 1 < row->rsize) {
-                    row->highlight[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
-                if (c == inString) {
-                    inString = 0;
-                }
-                ++i;
-                prevSep = 1;
+            if ((action->delimiters & LEX_MLC_END) &&
+                (length = matchDelimiter(&text[i], size - i, syntax->multiLineCommentEnd))) {
+                fillHighlight(hl, i, HL_MULTILINE_COMMENT, length);
+                i += length;
+                lex = LEX_SEP;
                 continue;
-            } else {
-                if (c == '"' || c == '\'') {
-                    inString = c;
-                    row->highlight[i] = HL_STRING;
-                    ++i;
-                    continue;
-                }
             }
         }
 
-        //Number Syntax Checking
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            if ((isdigit(c) && (prevSep || prevHl == HL_NUMBER)) ||
-                (c == '.' && prevHl == HL_NUMBER)) {
-                row->highlight[i] = HL_NUMBER;
-                ++i;
-                prevSep = 0;
+        if (action->keyword) {
+            int type;
+            int keylen = matchKeyword(&syntax->keywords, &text[i], size - i, &type);
+            if (keylen >= 0) {
+                fillHighlight(hl, i, (type == KW_KEYWORD2) ? HL_KEYWORD2 : HL_KEYWORD1, keylen);
+                i += keylen;
+                lex = LEX_WORD;
                 continue;
             }
         }
 
-        //Keywords
-        if (prevSep) {
-            int j;
-            for (j = 0; keywords[j]; j++) {
-                int keylen = strlen(keywords[j]);
-                int iskw2 = keywords[j][keylen - 1] == '|';
-                if (iskw2) {
-                    keylen--;
-                }
-                if (!strncmp(&row->render[i], keywords[j], keylen) &&
-                    isSeperator(row->render[i + keylen])) {
-                    memset(&row->highlight[i], iskw2 ? HL_KEYWORD2 : HL_KEYWORD1, keylen);
-                    i += keylen;
-                    break;
-                }
-            }
-            if (keywords[j] != NULL) {
-                prevSep = 0;
-                continue;
+        if (hl) {
+            hl[i] = action->hl;
+        }
+        lex = action->next;
+        ++i;
+    }
+    return (lex == LEX_COMMENT) ? HL_STATE_COMMENT : HL_STATE_NORMAL;
+}
+
+void editorSetRowState(int at, int state) {
+    //Stores the lexer state at the end of a row, at is a row whose checkpoint is valid or the first stale one
+    //Once a row after the stale ones ends in the state it already had, the checkpoints after it are valid again
+    erow* row = editorRow(at);
+    if (at < E.hl_valid) {
+        if (row->hl_state == state) {
+            return;
+        }
+        E.hl_valid = at + 1;
+        E.hl_resume = E.hl_end = E.hl_valid;
+    } else if (at >= E.hl_resume && at < E.hl_end && row->hl_state == state) {
+        E.hl_valid = E.hl_end;
+    } else {
+        E.hl_valid = at + 1;
+    }
+    row->hl_state = state;
+
+    if (E.hl_resume < E.hl_valid) {
+        E.hl_resume = E.hl_valid;
+    }
+    if (E.hl_resume >= E.hl_end) {
+        E.hl_resume = E.hl_end = E.hl_valid;
+    }
+}
+
+void editorInvalidateSyntax(int at) {
+    //Marks the checkpoint of a changed row stale without touching the rows after it
+    //Rows from hl_valid to hl_resume are stale, rows from hl_resume to hl_end still agree with each other
+    //and become valid again as soon as the lexer reaches one of them in the state it ended in before
+    editorCancelHighlight(at);
+    if (at < E.hl_valid) {
+        if (E.hl_resume == E.hl_end) {
+            E.hl_resume = at + 1;
+            E.hl_end = E.hl_valid;
+        }
+        E.hl_valid = at;
+    } else if (at >= E.hl_resume && at < E.hl_end) {
+        if (at == E.hl_resume) {
+            E.hl_resume++;
+        } else {
+            E.hl_end = at;
+        }
+    }
+    if (E.hl_resume >= E.hl_end) {
+        E.hl_resume = E.hl_end = E.hl_valid;
+    }
+}
+
+void editorShiftSyntax(int at, int by) {
+    //Moves the checkpoint bounds after a row was inserted (by 1) or deleted (by -1) at a position
+    if (E.hl_valid > at) {
+        E.hl_valid += by;
+    }
+    if (E.hl_resume > at) {
+        E.hl_resume += by;
+    }
+    if (E.hl_end > at) {
+        E.hl_end += by;
+    }
+    editorInvalidateSyntax(at);
+}
+
+int editorSyntaxState(int at) {
+    //Returns the lexer state at the start of a row, moving the checkpoints forward from the last valid one
+    //Rows passed over on the way are only lexed for their state and not highlighted
+    while (E.hl_valid < at) {
+        int valid = E.hl_valid;
+        erow* row = editorRow(valid);
+        int state = valid > 0 ? editorRow(valid - 1)->hl_state : HL_STATE_NORMAL;
+        if (row->render) {
+            state = editorLexRow(E.syntax, row->render, row->rsize, state, NULL);
+        } else {
+            state = editorLexRow(E.syntax, row->chars, row->size, state, NULL);
+        }
+        editorSetRowState(valid, state);
+    }
+    return at > 0 ? editorRow(at - 1)->hl_state : HL_STATE_NORMAL;
+}
+
+void editorCompressHighlight(erow* row, unsigned char* hl) {
+    //Stores a highlight array as runs of one color on the row, up to the last colored character
+    //Runs start where the one before them ends, a run longer than a span can hold is split in two
+    int end = row->rsize;
+    while (end > 0 && hl[end - 1] == HL_NORMAL) {
+        end--;
+    }
+    int count = 0;
+    int length = 0;
+    int i;
+    for (i = 0; i < end; i++) {
+        if (i == 0 || hl[i] != hl[i - 1] || length == USHRT_MAX) {
+            count++;
+            length = 0;
+        }
+        length++;
+    }
+    free(row->spans);
+    row->spans = NULL;
+    row->span_count = count;
+    if (!count) {
+        return;
+    }
+    row->spans = malloc(count * sizeof(struct hlSpan));
+    if (!row->spans) {
+        die("malloc");
+    }
+    struct hlSpan* span = row->spans - 1;
+    for (i = 0; i < end; i++) {
+        if (i == 0 || hl[i] != hl[i - 1] || span->length == USHRT_MAX) {
+            span++;
+            span->length = 0;
+            span->hl = hl[i];
+        }
+        span->length++;
+    }
+}
+
+erow* editorHighlightRow(int at) {
+    //Prepares and highlights a row, the highlight is kept until the row or the state it starts in changes
+    erow* row = editorPrepareRow(at);
+    int start = editorSyntaxState(at);
+    if (row->hl_start == start && row->hl_generation == E.hl_generation) {
+        return row;
+    }
+    if (row->rsize > E.hl_scratch_size) {
+        E.hl_scratch_size = row->rsize;
+        E.hl_scratch = realloc(E.hl_scratch, E.hl_scratch_size);
+        if (!E.hl_scratch) {
+            die("realloc");
+        }
+    }
+    int end = editorLexRow(E.syntax, row->render, row->rsize, start, E.hl_scratch);
+    editorCompressHighlight(row, E.hl_scratch);
+    row->hl_start = start;
+    row->hl_generation = E.hl_generation;
+    editorSetRowState(at, end);
+    return row;
+}
+
+int editorSyntaxReady(int at) {
+    //Returns 1 when a row is close enough to the last valid checkpoint to be highlighted right away
+    return E.syntax == NULL || at - E.hl_valid <= HL_SYNC_ROWS;
+}
+
+void* highlighterThread(void* arg) {
+    //Works out the lexer state at the end of every row of a job, the rows text is frozen while it runs
+    (void) arg;
+    pthread_mutex_lock(&highlighter.lock);
+    while (1) {
+        while (!highlighter.busy || highlighter.done) {
+            pthread_cond_wait(&highlighter.wake, &highlighter.lock);
+        }
+        pthread_mutex_unlock(&highlighter.lock);
+
+        int state = highlighter.state;
+        int i;
+        for (i = 0; i < highlighter.count; i++) {
+            state = editorLexRow(highlighter.syntax, highlighter.rows[i].text, highlighter.rows[i].size, state, NULL);
+            highlighter.states[i] = state;
+        }
+
+        pthread_mutex_lock(&highlighter.lock);
+        highlighter.done = 1;
+        editorWake();
+    }
+    return NULL;
+}
+
+void editorQueueHighlight() {
+    //Hands the highlighter the next rows after the last valid checkpoint, up to the rows the screen is waiting
+    //for or the end of the rows left stale by an edit, at most HL_JOB_ROWS at a time
+    if (highlighter.busy || E.syntax == NULL) {
+        return;
+    }
+    int target = E.hl_target;
+    if (E.hl_resume < E.hl_end && E.hl_end > target) {
+        target = E.hl_end;
+    }
+    if (target > E.num_rows) {
+        target = E.num_rows;
+    }
+    if (E.hl_valid >= target) {
+        E.hl_target = 0;
+        return;
+    }
+
+    int count = target - E.hl_valid;
+    if (count > HL_JOB_ROWS) {
+        count = HL_JOB_ROWS;
+    }
+    if (count > highlighter.capacity) {
+        highlighter.capacity = count;
+        highlighter.rows = realloc(highlighter.rows, count * sizeof(struct loadedLine));
+        highlighter.states = realloc(highlighter.states, count);
+        if (!highlighter.rows || !highlighter.states) {
+            die("realloc");
+        }
+    }
+    int i;
+    for (i = 0; i < count; i++) {
+        erow* row = editorRow(E.hl_valid + i);
+        highlighter.rows[i].text = row->chars;
+        highlighter.rows[i].size = row->size;
+    }
+    freezeRows(E.rows);
+    highlighter.syntax = E.syntax;
+    highlighter.start = E.hl_valid;
+    highlighter.state = editorSyntaxState(E.hl_valid);
+    highlighter.count = count;
+    highlighter.limit = E.hl_valid + count;
+
+    if (!highlighter.started) {
+        //Picks the scanning code before a second thread can use it
+        scanBytes("", 0, 0, 0);
+        if (pthread_create(&highlighter.thread, NULL, highlighterThread, NULL)) {
+            releaseRows(E.rows);
+            return;
+        }
+        highlighter.started = 1;
+    }
+    pthread_mutex_lock(&highlighter.lock);
+    highlighter.busy = 1;
+    highlighter.done = 0;
+    pthread_cond_signal(&highlighter.wake);
+    pthread_mutex_unlock(&highlighter.lock);
+}
+
+int editorSyncHighlighter() {
+    //Takes the states from a finished highlighter job and queues the next one
+    //Returns 1 when the screen was waiting on the states and should be redrawn
+    int redraw = 0;
+    if (highlighter.busy) {
+        pthread_mutex_lock(&highlighter.lock);
+        int done = highlighter.done;
+        pthread_mutex_unlock(&highlighter.lock);
+        if (!done) {
+            return 0;
+        }
+        releaseRows(E.rows);
+
+        //States are only used from the last valid checkpoint on, for rows that have not changed since
+        //the job was queued, and only while they carry on from the state that checkpoint ended in
+        int start = highlighter.start;
+        int end = highlighter.limit;
+        int at = E.hl_valid;
+        if (at >= start && at < end &&
+            editorSyntaxState(at) == (at == start ? highlighter.state : highlighter.states[at - start - 1])) {
+            while (E.hl_valid >= start && E.hl_valid < end) {
+                editorSetRowState(E.hl_valid, highlighter.states[E.hl_valid - start]);
             }
+            redraw = (E.hl_target != 0);
         }
 
-        prevSep = isSeperator(c);
-        ++i;
+        pthread_mutex_lock(&highlighter.lock);
+        highlighter.busy = 0;
+        highlighter.done = 0;
+        pthread_mutex_unlock(&highlighter.lock);
     }
-    //Update hl_open_comment
-    int changed = (row->hl_open_comment != inComment);
-    row->hl_open_comment = inComment;
-    if (changed && row->index + 1 < E.num_rows) {
-        editorUpdateSyntax(&E.row[row->index + 1]);
+    editorQueueHighlight();
+    return redraw;
+}
+
+void editorCancelHighlight(int at) {
+    //States the running job finds for rows from at on are thrown away, the rows changed or moved
+    if (highlighter.busy && at < highlighter.limit) {
+        highlighter.limit = at;
     }
 }
 
@@ -460,7 +1096,11 @@ int syntaxToColor(int hl) {
 
 void editorSelectSyntaxHighlight() {
     //Given the file, selects what format of syntax highlighting to use
+    //Every checkpoint and highlight is stale, rows are highlighted again when they are drawn
     E.syntax = NULL;
+    E.hl_valid = E.hl_resume = E.hl_end = 0;
+    E.hl_generation++;
+    editorCancelHighlight(0);
     if (E.filename == NULL) {
         return;
     }
@@ -475,11 +1115,6 @@ void editorSelectSyntaxHighlight() {
             if ((isExt && ext && !strcmp(ext, s->filematch[i])) ||
                 (!isExt && strstr(E.filename, s->filematch[i]))) {
                 E.syntax = s;
-
-                int filerow;
-                for (filerow = 0; filerow < E.num_rows; ++filerow) {
-                    editorUpdateSyntax(&E.row[filerow]);
-                }
                 return;
             }
             ++i;
@@ -489,24 +1124,34 @@ void editorSelectSyntaxHighlight() {
 
 //ROW OPS
 
-void setRowIndent(erow* row) {
-    //Sets the number of indents found at the beginning of the row
-    char *c = &row->chars[0];
+erow* editorRow(int at) {
+    //Returns the row of text at a position in the file
+    return getRow(E.rows, at);
+}
+
+int textIndent(const char* text, int size) {
+    //Returns the number of indents found at the beginning of some text, a tab or tab_stop spaces is one
     int consecSpace = 0;
-    row->indent = 0;
-    while (isspace(*c) || *c == '\t') {
-        if (*c == '\t') {
+    int indent = 0;
+    int k;
+    for (k = 0; k < size && isspace(text[k]); k++) {
+        if (text[k] == '\t') {
             consecSpace = 0;
-            row->indent++;
-        } else if (isspace(*c)) {
+            indent++;
+        } else {
             consecSpace++;
             if (consecSpace == config.tab_stop) {
-                row->indent++;
+                indent++;
                 consecSpace = 0;
             }
         }
-        ++c;
     }
+    return indent;
+}
+
+void setRowIndent(erow* row) {
+    //Sets the number of indents found at the beginning of the row
+    row->indent = textIndent(row->chars, row->size);
 }
 
 int rowCursorXToRenderX(erow* row, int cursorx) {
@@ -539,8 +1184,16 @@ int rowRenderXToCursorX(erow* row, int renderx) {
 }
 
 void editorUpdateRow(erow* row) {
-    
-    //Updates a row of text
+    //Updates a row of text after it changed, it is highlighted again the next time it is drawn
+    editorInvalidateSyntax(getRowIndex(E.rows, row));
+    row->hl_start = -1;
+    editorRenderRow(row);
+}
+
+void editorRenderRow(erow* row) {
+    //Builds the rendered text of a row, converting tabs to spaces
+    setRowIndent(row);
+
     int tabs = 0;
     int j;
     for (j = 0; j < row->size; j++) {
@@ -566,58 +1219,87 @@ void editorUpdateRow(erow* row) {
     }
     row->render[renderIndex] = '\0';
     row->rsize = renderIndex;
+}
+
+erow* editorPrepareRow(int at) {
+    //Builds the render of a row from the file the first time it is needed
+    erow* row = editorRow(at);
+    if (!row->render) {
+        editorRenderRow(row);
+    }
+    return row;
+}
+
+void editorAppendFileRow(char* text, size_t len) {
+    //Adds a row pointing into the file mapping, it is only copied and rendered once it is needed
+    erow* row = insertRow(E.rows, E.num_rows);
+    row->indent = 0;
+    row->size = len;
+    row->capacity = 0;
+    row->epoch = 0;
+    row->chars = text;
+    row->rsize = 0;
+    row->render = NULL;
+    row->spans = NULL;
+    row->span_count = 0;
+    row->hl_state = HL_STATE_NORMAL;
+    row->hl_start = -1;
+    row->hl_generation = 0;
+    ++(E.num_rows);
+}
+
+erow* editorNewRow(int rowAt, int len) {
+    //Inserts a row with room for len characters at a position, the caller fills in the text and updates it
+    erow* row = insertRow(E.rows, rowAt);
+    row->indent = 0;
+    row->size = 0;
+    row->capacity = 0;
+    row->chars = NULL;
+    reserveRowChars(E.rows, row, len);
+    row->size = len;
+    row->chars[len] = '\0';
+
+    row->rsize = 0;
+    row->render = NULL;
+    row->spans = NULL;
+    row->span_count = 0;
+    row->hl_state = HL_STATE_NORMAL;
+    row->hl_start = -1;
+    row->hl_generation = 0;
+    editorShiftSyntax(rowAt, 1);
 
-    editorUpdateSyntax(row);
+    ++(E.num_rows);
+    ++(E.dirty);
+    return row;
 }
 
 void editorInsertRow(int rowAt, char* text, size_t len) {
 
-    //Inserts a row at a position and updates other row indecies
+    //Inserts a row at a position
     if (rowAt < 0 || rowAt > E.num_rows) {
         return;
     }
 
-    E.row = realloc(E.row, sizeof(erow) * (E.num_rows + 1));
-    memmove(&E.row[rowAt + 1], &E.row[rowAt], sizeof(erow) * (E.num_rows - rowAt));
-
-    for (int j = rowAt + 1; j < E.num_rows; j++) {
-        E.row[j].index++;
-    }
-
-    E.row[rowAt].index = rowAt;
-    E.row[rowAt].indent = 0;
-    E.row[rowAt].size = len;
-    E.row[rowAt].chars = malloc(len + 1);
-    memcpy(E.row[rowAt].chars, text, len);
-    E.row[rowAt].chars[len] = '\0';
-
-    E.row[rowAt].rsize = 0;
-    E.row[rowAt].render = NULL;
-    E.row[rowAt].highlight = NULL;
-    E.row[rowAt].hl_open_comment = 0;
-    editorUpdateRow(&E.row[rowAt]);
-
-    ++(E.num_rows);
-    ++(E.dirty);
+    erow* row = editorNewRow(rowAt, len);
+    memcpy(row->chars, text, len);
+    editorUpdateRow(row);
 }
 
 void editorFreeRow(erow* row) {
-    //Frees heap memory used by a row
+    //Frees heap memory used by a row, rows still pointing into the file mapping do not own their chars
     free(row->render);
-    free(row->chars);
-    free(row->highlight);
+    freeRowChars(E.rows, row);
+    free(row->spans);
 }
 
 void editorDeleteRow(int pos) {
-    //Removes a row and updates other row indecies
+    //Removes a row
     if (pos < 0 || pos >= E.num_rows) {
         return;
     }
-    editorFreeRow(&E.row[pos]);
-    memmove(&E.row[pos], &E.row[pos + 1], sizeof(erow) * (E.num_rows - pos - 1));
-    for (int j = pos; j < E.num_rows; j++) {
-        E.row[j].index--;
-    }
+    editorFreeRow(editorRow(pos));
+    deleteRow(E.rows, pos);
+    editorShiftSyntax(pos, -1);
     E.num_rows--;
     E.dirty++;
 }
@@ -627,7 +1309,7 @@ void rowInsertChar(erow* row, int pos, int charToInsert) {
     if (pos < 0 || pos > row->size) {
         pos = row->size;
     }
-    row->chars = realloc(row->chars, row->size + 2);
+    reserveRowChars(E.rows, row, row->size + 1);
     memmove(&row->chars[pos + 1], &row->chars[pos], row->size - pos + 1);
     row->size++;
     row->chars[pos] = charToInsert;
@@ -635,9 +1317,22 @@ void rowInsertChar(erow* row, int pos, int charToInsert) {
     ++(E.dirty);
 }
 
+void rowInsertString(erow* row, int pos, const char* text, int length) {
+    //Inserts a string of characters at a position in a row, the row is rendered once for all of them
+    if (pos < 0 || pos > row->size) {
+        pos = row->size;
+    }
+    reserveRowChars(E.rows, row, row->size + length);
+    memmove(&row->chars[pos + length], &row->chars[pos], row->size - pos + 1);
+    memcpy(&row->chars[pos], text, length);
+    row->size += length;
+    editorUpdateRow(row);
+    ++(E.dirty);
+}
+
 void rowAppendString(erow* row, char* text, size_t length) {
     //Adds a string of characters to the end of a row
-    row->chars = realloc(row->chars, row->size + length + 1);
+    reserveRowChars(E.rows, row, row->size + length);
     memcpy(&row->chars[row->size], text, length);
     row->size += length;
     row->chars[row->size] = '\0';
@@ -650,6 +1345,7 @@ void rowDeleteChar(erow* row, int pos) {
     if (pos < 0 || pos >= row->size) {
         return;
     }
+    reserveRowChars(E.rows, row, row->size);
     memmove(&row->chars[pos], &row->chars[pos + 1], row->size - pos);
     row->size--;
     editorUpdateRow(row);
@@ -658,59 +1354,224 @@ void rowDeleteChar(erow* row, int pos) {
 
 //EDITOR OPERATIONS
 
+void editorRecordInsert(int group, const char* text, int length) {
+    //Records text about to be inserted at the cursor in the undo log
+    //Past the last row it is recorded as a new line after the last row, so undoing it removes the rows it makes
+    startUndoTransaction(undo, group);
+    if (E.cursory < E.num_rows || E.num_rows == 0) {
+        addUndoRecord(undo, E.num_rows ? UNDO_INSERT : UNDO_INSERT_FIRST, E.cursory, E.cursorx, text, length, E.cursory, E.cursorx);
+        return;
+    }
+    if (length > 0 && text[length - 1] == '\n') {
+        //A row is only made there for lines with text, so a last line break makes no row of its own
+        length--;
+    }
+    char* lines = malloc(length + 1);
+    if (!lines) {
+        exit(EXIT_FAILURE);
+    }
+    lines[0] = '\n';
+    memcpy(&lines[1], text, length);
+    int y = E.num_rows - 1;
+    addUndoRecord(undo, UNDO_INSERT, y, editorRow(y)->size, lines, length + 1, E.cursory, E.cursorx);
+    free(lines);
+}
+
+int editorPastLoadedEnd() {
+    //Nothing can be added past the last row while the file is still loading, the rest of the file goes there
+    if (E.loading && E.cursory >= E.num_rows) {
+        setStatusMessage("Still loading, the end of the file can be edited once it is loaded");
+        return 1;
+    }
+    return 0;
+}
+
 void editorInsertChar(int c) {
-    //Inserts a character in the editor and increments cursor
+    //Inserts a character in the editor and increments cursor, typing runs on in one undo record
+    if (editorPastLoadedEnd()) {
+        return;
+    }
+    char text = c;
+    editorRecordInsert(GROUP_TYPING, &text, 1);
     if (E.cursory == E.num_rows) {
         editorInsertRow(E.num_rows, "", 0);
     }
-    rowInsertChar(&E.row[E.cursory], E.cursorx, c);
-    setRowIndent(&E.row[E.cursory]);
+    rowInsertChar(editorRow(E.cursory), E.cursorx, c);
     E.cursorx++;
 }
 
-void editorInsertNewLine(int isStackSwaping) {
+void editorInsertString(int y, int x, const char* text, int length, int* endY, int* endX) {
+    //Inserts text at a position, each \n in it starts a new row
+    //The new rows are all made in one pass and each row touched is rendered once, endY and endX are set to where the text ends
+    //Past the last row a row is only made for lines that have text, like typing there would
+    int pastEnd = (y == E.num_rows);
+    if (pastEnd) {
+        editorInsertRow(E.num_rows, "", 0);
+    }
+    erow* row = editorRow(y);
+    if (x < 0 || x > row->size) {
+        x = row->size;
+    }
+    const char* firstBreak = memchr(text, '\n', length);
+    if (!firstBreak) {
+        if (length > 0) {
+            rowInsertString(row, x, text, length);
+        }
+        *endY = y;
+        *endX = x + length;
+        return;
+    }
+
+    //Every line after the first gets a row of its own, the rest of the row at the position moves to the last one
+    int tailLength = row->size - x;
+    int at = y + 1;
+    const char* line = firstBreak + 1;
+    const char* end = text + length;
+    const char* newline;
+    while ((newline = memchr(line, '\n', end - line))) {
+        editorInsertRow(at++, (char*) line, newline - line);
+        line = newline + 1;
+    }
+    int lastLength = end - line;
+    row = editorRow(y);
+    if (!pastEnd || lastLength > 0) {
+        erow* last = editorNewRow(at, lastLength + tailLength);
+        row = editorRow(y);
+        memcpy(last->chars, line, lastLength);
+        memcpy(&last->chars[lastLength], &row->chars[x], tailLength);
+        editorUpdateRow(last);
+    }
+
+    //The first line replaces the rest of the row at the position
+    int firstLength = firstBreak - text;
+    reserveRowChars(E.rows, row, x + firstLength);
+    memcpy(&row->chars[x], text, firstLength);
+    row->size = x + firstLength;
+    row->chars[row->size] = '\0';
+    editorUpdateRow(row);
+    ++(E.dirty);
+
+    *endY = at;
+    *endX = lastLength;
+}
+
+void editorInsertNewLine() {
     //Inserts a new line in the editor based on cursor position
-    if (E.cursorx == 0) {
-        editorInsertRow(E.cursory, "", 0);
-    } else {
-        erow* row= &E.row[E.cursory];
-        editorInsertRow(E.cursory + 1, &row->chars[E.cursorx], row->size - E.cursorx);
-        row = &E.row[E.cursory];
-        row->size = E.cursorx;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
-    }
-    E.cursory++;
-    E.cursorx = 0;
+    //With auto indent the new row starts with as many tabs as the text before the cursor is indented, in the same insert
+    if (editorPastLoadedEnd()) {
+        return;
+    }
+    int indent = 0;
+    if ((config.auto_indent == 1) && E.cursory < E.num_rows) {
+        indent = textIndent(editorRow(E.cursory)->chars, E.cursorx);
+    }
+    char* text = malloc(indent + 1);
+    if (!text) {
+        exit(EXIT_FAILURE);
+    }
+    text[0] = '\n';
+    memset(&text[1], '\t', indent);
+    editorRecordInsert(GROUP_ALONE, text, indent + 1);
+    editorInsertString(E.cursory, E.cursorx, text, indent + 1, &E.cursory, &E.cursorx);
+    free(text);
+}
 
-    if ((config.auto_indent == 1) && !isStackSwaping) {
-        int indent = E.row[E.cursory - 1].indent;
-        E.row[E.cursory].indent = indent;
-        int i;
-        for (i = 0; i < indent; i++) {
-            editorInsertChar('\t');
+int editorDeleteString(int y, int x, int length, char* removed) {
+    //Deletes length characters from a position, the end of a row counts as one character that joins the next row on
+    //The rows in between are removed in one pass and the row left is rendered once
+    //The text deleted is copied to removed when it is not NULL, returns how many characters there were to delete
+    erow* row = editorRow(y);
+    if (x > row->size) {
+        x = row->size;
+    }
+    int endY = y;
+    int endX = x;
+    int deleted = 0;
+    while (deleted < length) {
+        erow* end = editorRow(endY);
+        int take = end->size - endX;
+        if (take > length - deleted) {
+            take = length - deleted;
+        }
+        if (removed) {
+            memcpy(&removed[deleted], &end->chars[endX], take);
+        }
+        endX += take;
+        deleted += take;
+        if (deleted == length) {
+            break;
         }
+        if (endY + 1 >= E.num_rows) {
+            break;
+        }
+        if (removed) {
+            removed[deleted] = '\n';
+        }
+        deleted++;
+        endY++;
+        endX = 0;
+    }
+    if (deleted == 0) {
+        return 0;
+    }
+
+    //The rest of the last row is moved onto the first one
+    erow* last = editorRow(endY);
+    int tailLength = last->size - endX;
+    if (endY == y) {
+        reserveRowChars(E.rows, row, row->size);
+        memmove(&row->chars[x], &row->chars[endX], tailLength + 1);
+    } else {
+        reserveRowChars(E.rows, row, x + tailLength);
+        memcpy(&row->chars[x], &last->chars[endX], tailLength);
+    }
+    row->size = x + tailLength;
+    row->chars[row->size] = '\0';
+    int i;
+    for (i = y; i < endY; i++) {
+        editorDeleteRow(y + 1);
     }
+    editorUpdateRow(editorRow(y));
+    E.dirty++;
+    return deleted;
 }
 
-void editorDeleteChar() {
-    //Deletes a character in the editor at the cursor position
+void editorDeleteChars(int count, int forward) {
+    //Deletes count characters behind the cursor as one operation, going back over row ends
+    //Forward deletes were made by stepping over the character first, undoing them leaves the cursor in front of it
     if (E.cursory == E.num_rows) {
         return;
     }
-    if (E.cursorx == 0 && E.cursory == 0) {
+    int y = E.cursory;
+    int x = E.cursorx;
+    int steps;
+    for (steps = 0; steps < count; steps++) {
+        if (x > 0) {
+            x--;
+        } else if (y > 0) {
+            y--;
+            x = editorRow(y)->size;
+        } else {
+            break;
+        }
+    }
+    if (steps == 0) {
         return;
     }
-    erow* row = &E.row[E.cursory];
-    if (E.cursorx > 0) {
-        rowDeleteChar(row, E.cursorx - 1);
-        E.cursorx--;
+    char* text = malloc(steps);
+    if (!text) {
+        exit(EXIT_FAILURE);
+    }
+    int deleted = editorDeleteString(y, x, steps, text);
+    startUndoTransaction(undo, forward ? GROUP_DELETE : GROUP_BACKSPACE);
+    if (forward) {
+        addUndoRecord(undo, UNDO_DELETE, y, x, text, deleted, y, x);
     } else {
-        E.cursorx = E.row[E.cursory - 1].size;
-        rowAppendString(&E.row[E.cursory - 1], row->chars, row->size);
-        editorDeleteRow(E.cursory);
-        E.cursory--;
+        addUndoRecord(undo, UNDO_DELETE, y, x, text, deleted, E.cursory, E.cursorx);
     }
+    free(text);
+    E.cursory = y;
+    E.cursorx = x;
 }
 
 //FIND
@@ -720,14 +1581,7 @@ void editorFindCallback(char* query, int key) {
     static int last_match = -1;
     static int direction = 1;
 
-    static int saved_hl_line;
-    static char* saved_hl = NULL;
-
-    if (saved_hl) {
-        memcpy(E.row[saved_hl_line].highlight, saved_hl, E.row[saved_hl_line].rsize);
-        free(saved_hl);
-        saved_hl = NULL;
-    }
+    E.find_row = -1;
 
     //Determines direction to move from key press
     if (key == '\r' || key == '\x1b') {
@@ -743,109 +1597,593 @@ void editorFindCallback(char* query, int key) {
         direction = 1;
     }
 
-    if (last_match == -1) {
-        direction = 1;
+    if (last_match == -1) {
+        direction = 1;
+    }
+    int current = last_match;
+
+    int r;
+    for (r = 0; r < E.num_rows; ++r) {
+        //Based on current, find next occuring query, Move current to start or end if necissary
+        current += direction;
+        if (current == -1) {
+            current = E.num_rows - 1;
+        } else if (current == E.num_rows) {
+            current = 0;
+        }
+        erow* row = editorRow(current);
+        if (!row->render && !strchr(query, ' ') &&
+            !memmem(row->chars, row->size, query, strlen(query))) {
+            //Tabs only render as spaces, so a query without spaces can be checked against the unprepared row
+            continue;
+        }
+        row = editorPrepareRow(current);
+        char* match = strstr(row->render, query);
+        if (match) {
+            last_match = current;
+            E.cursory = current;
+            E.cursorx = rowRenderXToCursorX(row, match - row->render);
+            E.rowoff = E.num_rows;
+
+            //The match is drawn over the rows highlight until the next search
+            E.find_row = current;
+            E.find_start = match - row->render;
+            E.find_length = strlen(query);
+            break;
+        }
+    }
+}
+
+void editorFind() {
+    //Enteres mode to find strings in a file
+    int save_cursorx = E.cursorx;
+    int save_cursory = E.cursory;
+    int save_rowoff = E.rowoff;
+    int save_coloff = E.coloff;
+
+    char* query = editorPrompt("Search: %s (Left/Right Arrows to Navigate, ESC to quit)", editorFindCallback);
+
+    if (query) {
+        free(query);
+    } else if (config.cursor_save) {
+        E.cursorx = save_cursorx;
+        E.cursory = save_cursory;
+        E.rowoff = save_rowoff;
+        E.coloff = save_coloff;
+    }
+    if (E.cursorx != save_cursorx || E.cursory != save_cursory) {
+        //Like any other cursor move, a jump to a match keeps the next edit out of the last transaction
+        breakUndoTransaction(undo);
+    }
+}
+
+//FILE IO
+
+char* scanLines(char* start, char* end, struct loadedLine* lines, int maxLines, int* count) {
+    //Finds up to maxLines lines from start, returns where the next line begins
+    *count = 0;
+    while (start < end && *count < maxLines) {
+        //memchr scans for the newline many bytes at a time
+        char* newLine = memchr(start, '\n', end - start);
+        char* lineEnd = newLine ? newLine : end;
+        int lineLen = lineEnd - start;
+        while (lineLen > 0 && start[lineLen - 1] == '\r') {
+            lineLen--;
+        }
+        lines[*count].text = start;
+        lines[*count].size = lineLen;
+        ++(*count);
+        start = lineEnd + 1;
+    }
+    return start < end ? start : end;
+}
+
+void* loaderThread(void* arg) {
+    //Indexes the lines of the mapped file in batches and hands them over to the editor
+    (void)arg;
+    struct loadedLine batch[LOAD_BATCH_LINES];
+    int count;
+    char* next = loader.next;
+    unsigned long long hash = UNDO_HASH_START;
+    if (loader.hashing) {
+        //The lines indexed before the loader started are hashed first
+        hash = undoHash(hash, E.map, next - E.map);
+    }
+    while (next < loader.end) {
+        char* from = next;
+        next = scanLines(next, loader.end, batch, LOAD_BATCH_LINES, &count);
+        if (loader.hashing) {
+            hash = undoHash(hash, from, next - from);
+        }
+
+        pthread_mutex_lock(&loader.lock);
+        while (loader.count + count > LOAD_STAGED_LINES) {
+            pthread_cond_wait(&loader.room, &loader.lock);
+        }
+        int i;
+        for (i = 0; i < count; i++) {
+            loader.lines[(loader.head + loader.count + i) % LOAD_STAGED_LINES] = batch[i];
+        }
+        //The editor is woken once there is a full sync of rows waiting, it keeps adding them while more wait
+        int wake = (loader.count < LOAD_SYNC_ROWS && loader.count + count >= LOAD_SYNC_ROWS);
+        loader.count += count;
+        loader.next = next;
+        pthread_cond_signal(&loader.staged);
+        pthread_mutex_unlock(&loader.lock);
+        if (wake) {
+            editorWake();
+        }
+    }
+    pthread_mutex_lock(&loader.lock);
+    loader.hash = hash;
+    loader.done = 1;
+    pthread_cond_signal(&loader.staged);
+    pthread_mutex_unlock(&loader.lock);
+    editorWake();
+    return NULL;
+}
+
+int editorSyncLoader() {
+    //Adds up to LOAD_SYNC_ROWS lines found by the loader to the rows, returns 1 when anything changed
+    //Lines left over are added by the next call, E.load_pending says there are some
+    if (!E.loading) {
+        return 0;
+    }
+    static struct loadedLine lines[LOAD_SYNC_ROWS];
+    pthread_mutex_lock(&loader.lock);
+    int count = loader.count < LOAD_SYNC_ROWS ? loader.count : LOAD_SYNC_ROWS;
+    int i;
+    for (i = 0; i < count; i++) {
+        lines[i] = loader.lines[(loader.head + i) % LOAD_STAGED_LINES];
+    }
+    loader.head = (loader.head + count) % LOAD_STAGED_LINES;
+    loader.count -= count;
+    int done = loader.done && loader.count == 0;
+    E.load_pending = loader.count > 0;
+    if (count > 0) {
+        pthread_cond_signal(&loader.room);
+    }
+    pthread_mutex_unlock(&loader.lock);
+
+    for (i = 0; i < count; i++) {
+        editorAppendFileRow(lines[i].text, lines[i].size);
+    }
+    if (count > 0) {
+        E.load_percent = (lines[count - 1].text - E.map) * 100 / E.map_size;
+    }
+
+    if (done) {
+        pthread_join(loader.thread, NULL);
+        pthread_mutex_destroy(&loader.lock);
+        pthread_cond_destroy(&loader.staged);
+        pthread_cond_destroy(&loader.room);
+        free(loader.lines);
+        if (loader.hashing) {
+            checkUndoHistory(undo, loader.hash);
+        }
+        E.loading = 0;
+        return 1;
+    }
+    return count > 0;
+}
+
+void editorFinishLoading() {
+    //Waits for the loader to index the whole file and adds the remaining lines
+    while (E.loading) {
+        pthread_mutex_lock(&loader.lock);
+        while (!loader.done && loader.count == 0) {
+            pthread_cond_wait(&loader.staged, &loader.lock);
+        }
+        pthread_mutex_unlock(&loader.lock);
+        editorSyncLoader();
+    }
+}
+
+void editorMapFile(int file, size_t size) {
+    //Maps the file into memory, row text is not copied until a row is changed
+    char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (map == MAP_FAILED) {
+        die("mmap");
+    }
+    E.map = map;
+    E.map_size = size;
+}
+
+void editorIndexFile(int hash) {
+    //Indexes the first screen of lines of the mapped file right away and starts a loader thread for the rest
+    //With hash set the loader is started even when there is no rest, to hash the whole file
+    char* map = E.map;
+    size_t size = E.map_size;
+    struct loadedLine* lines = malloc((E.screen_rows + 1) * sizeof(struct loadedLine));
+    int count;
+    char* next = scanLines(map, map + size, lines, E.screen_rows + 1, &count);
+    int i;
+    for (i = 0; i < count; i++) {
+        editorAppendFileRow(lines[i].text, lines[i].size);
+    }
+    free(lines);
+    if (next == map + size && !hash) {
+        return;
+    }
+
+    loader.next = next;
+    loader.end = map + size;
+    loader.lines = malloc(LOAD_STAGED_LINES * sizeof(struct loadedLine));
+    if (!loader.lines) {
+        exit(EXIT_FAILURE);
+    }
+    loader.head = 0;
+    loader.count = 0;
+    loader.done = 0;
+    loader.hashing = hash;
+    pthread_mutex_init(&loader.lock, NULL);
+    pthread_cond_init(&loader.staged, NULL);
+    pthread_cond_init(&loader.room, NULL);
+    if (pthread_create(&loader.thread, NULL, loaderThread, NULL) != 0) {
+        die("pthread_create");
+    }
+    E.loading = 1;
+    E.load_percent = 0;
+    E.load_pending = 0;
+}
+
+void editorReadFile(FILE* file) {
+    //Reads the file line by line, used for files that can not be mapped
+    char* line = NULL;
+    size_t lineCap = 0;
+    ssize_t lineLen;
+    while ((lineLen = getline(&line, &lineCap, file)) != -1) {
+        //Adds all lines as text for a rows
+        while (lineLen > 0 && (line[lineLen - 1] == '\n' ||
+            line[lineLen - 1] == '\r' )) {
+            lineLen--;
+        }
+        editorInsertRow(E.num_rows, line, lineLen);
+    }
+    free(line);
+}
+
+char* editorFullPath(char* filename) {
+    //Returns the absolute path of a file, which only has to be in a directory that exists, or NULL when it is not
+    char* path = realpath(filename, NULL);
+    if (path) {
+        return path;
+    }
+    char* slash = strrchr(filename, '/');
+    char* dir = slash ? strndup(filename, slash - filename + 1) : strdup(".");
+    char* dirPath = realpath(dir, NULL);
+    free(dir);
+    if (!dirPath) {
+        return NULL;
+    }
+    char* base = slash ? slash + 1 : filename;
+    path = malloc(strlen(dirPath) + strlen(base) + 2);
+    if (!path) {
+        exit(EXIT_FAILURE);
+    }
+    sprintf(path, "%s%s%s", dirPath, strcmp(dirPath, "/") ? "/" : "", base);
+    free(dirPath);
+    return path;
+}
+
+void editorOpen(char* filename) {
+    //Opens a file in the editor if argument added
+    free(E.filename);
+    E.filename = strdup(filename);
+
+    editorSelectSyntaxHighlight();
+
+    FILE* file = fopen(filename, "r");
+    if (!file) {
+        die("fopen");
+    }
+    struct stat fileStat;
+    int regular = (fstat(fileno(file), &fileStat) == 0 && S_ISREG(fileStat.st_mode));
+    if (regular && fileStat.st_size > 0) {
+        editorMapFile(fileno(file), fileStat.st_size);
+    }
+
+    if (config.undo_history && regular) {
+        //The mapping keeps what the file held when opened, which the history is checked against
+        char* path = editorFullPath(filename);
+        if (path) {
+            openUndoHistory(undo, path, E.map, fileStat.st_size);
+            free(path);
+        }
+    }
+
+    if (E.map) {
+        //The loader hashes the file for the history, which is not undone from until it is done
+        editorIndexFile(undo->history_check);
+    } else {
+        editorReadFile(file);
+        if (undo->history_check) {
+            checkUndoHistory(undo, UNDO_HASH_START);
+        }
+    }
+
+    fclose(file);
+    E.dirty = 0;
+}
+
+int writeVectors(int file, struct iovec* iov, int count) {
+    //Writes all vectors to the file, continuing after short writes
+    while (count > 0) {
+        ssize_t written = writev(file, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+void addLinePieces(struct iovec** pieces, int* count, int* capacity, long long* length, char* text, size_t size,
+    int mapped) {
+    //Lists the text of a line and its newline as pieces to write, merged into the last piece when they follow it
+    //A line in the file mapping that already ends in a newline is listed along with it
+    static char newLine[] = "\n";
+    char* parts[2] = { text, newLine };
+    size_t sizes[2] = { size, 1 };
+    if (mapped && text + size < E.map + E.map_size && text[size] == '\n') {
+        sizes[0]++;
+        sizes[1] = 0;
+    }
+
+    int p;
+    for (p = 0; p < 2; p++) {
+        if (!sizes[p]) {
+            continue;
+        }
+        *length += sizes[p];
+        if (*count) {
+            struct iovec* last = &(*pieces)[*count - 1];
+            if ((char*)last->iov_base + last->iov_len == parts[p]) {
+                last->iov_len += sizes[p];
+                continue;
+            }
+        }
+        if (*count == *capacity) {
+            *capacity *= 2;
+            *pieces = realloc(*pieces, *capacity * sizeof(struct iovec));
+            if (!*pieces) {
+                exit(EXIT_FAILURE);
+            }
+        }
+        (*pieces)[*count].iov_base = parts[p];
+        (*pieces)[*count].iov_len = sizes[p];
+        ++(*count);
+    }
+}
+
+struct iovec* editorSnapshotRows(int* count, long long* length) {
+    //Lists the text of every row and its newline as pieces to write, the rows text is not copied
+    //Rows next to each other in the file mapping are listed as one piece along with their newlines
+    int capacity = 64;
+    struct iovec* pieces = malloc(capacity * sizeof(struct iovec));
+    *count = 0;
+    *length = 0;
+
+    int i;
+    for (i = 0; i < E.num_rows; i++) {
+        erow* row = editorRow(i);
+        addLinePieces(&pieces, count, &capacity, length, row->chars, row->size, !row->capacity);
     }
-    int current = last_match;
+    return pieces;
+}
 
-    int r;
-    for (r = 0; r < E.num_rows; ++r) {
-        //Based on current, find next occuring query, Move current to start or end if necissary
-        current += direction;
-        if (current == -1) {
-            current = E.num_rows - 1;
-        } else if (current == E.num_rows) {
-            current = 0;
-        }
-        erow* row = &E.row[current];
-        char* match = strstr(row->render, query);
-        if (match) {
-            last_match = current;
-            E.cursory = current;
-            E.cursorx = rowRenderXToCursorX(row, match - row->render);
-            E.rowoff = E.num_rows;
+#define SAVE_CHUNK (8 << 20)
 
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->highlight, row->rsize);
-            memset(&row->highlight[match - row->render], HL_MATCH, strlen(query));
-            break;
+int writePieces(int file, struct iovec* pieces, int pieceCount) {
+    //Writes pieces in batches of at most IOV_MAX pieces or SAVE_CHUNK bytes, updating the progress
+    struct iovec batch[IOV_MAX];
+    int i = 0;
+    size_t offset = 0;
+    while (i < pieceCount) {
+        int count = 0;
+        size_t bytes = 0;
+        while (i < pieceCount && count < IOV_MAX && bytes < SAVE_CHUNK) {
+            size_t size = pieces[i].iov_len - offset;
+            if (bytes + size > SAVE_CHUNK) {
+                size = SAVE_CHUNK - bytes;
+            }
+            batch[count].iov_base = (char*)pieces[i].iov_base + offset;
+            batch[count].iov_len = size;
+            if (saver.hashing) {
+                saver.hash = undoHash(saver.hash, batch[count].iov_base, size);
+            }
+            ++count;
+            bytes += size;
+            offset += size;
+            if (offset == pieces[i].iov_len) {
+                ++i;
+                offset = 0;
+            }
+        }
+        if (writeVectors(file, batch, count) == -1) {
+            return -1;
         }
+        pthread_mutex_lock(&saver.lock);
+        saver.written += bytes;
+        pthread_mutex_unlock(&saver.lock);
     }
+    return 0;
 }
 
-void editorFind() {
-    //Enteres mode to find strings in a file
-    int save_cursorx = E.cursorx;
-    int save_cursory = E.cursory;
-    int save_rowoff = E.rowoff;
-    int save_coloff = E.coloff;
-
-    char* query = editorPrompt("Search: %s (Left/Right Arrows to Navigate, ESC to quit)", editorFindCallback);
-
-    if (query) {
-        free(query);
-    } else if (config.cursor_save) {
-        E.cursorx = save_cursorx;
-        E.cursory = save_cursory;
-        E.rowoff = save_rowoff;
-        E.coloff = save_coloff;
+int writeTail(int file) {
+    //Writes the lines the loader had not added when the snapshot was taken, a batch of lines at a time
+    //They are split the way the loader splits them, so the file is written the same as once it is loaded
+    if (!saver.tail) {
+        return 0;
     }
+    struct loadedLine lines[LOAD_BATCH_LINES];
+    int capacity = 64;
+    struct iovec* pieces = malloc(capacity * sizeof(struct iovec));
+    long long length = 0;
+    int result = 0;
+    char* next = saver.tail;
+    while (result == 0 && next < saver.tail_end) {
+        int count;
+        int pieceCount = 0;
+        next = scanLines(next, saver.tail_end, lines, LOAD_BATCH_LINES, &count);
+        int i;
+        for (i = 0; i < count; i++) {
+            addLinePieces(&pieces, &pieceCount, &capacity, &length, lines[i].text, lines[i].size, 1);
+        }
+        result = writePieces(file, pieces, pieceCount);
+    }
+    free(pieces);
+    //The length was only known up to the line endings until now
+    pthread_mutex_lock(&saver.lock);
+    saver.length = saver.written;
+    pthread_mutex_unlock(&saver.lock);
+    return result;
 }
 
-//FILE IO
+int writeFileAtomic(char* filename) {
+    //Writes the snapshot to a temporary file next to the target, syncs it, and renames it over the target
+    //The target is either left untouched or fully replaced, even if the editor dies while saving
+    char* target = realpath(filename, NULL);
+    if (!target) {
+        target = strdup(filename);
+    }
 
-char* editorRowsToString(int* buflen) {
-    //Convertes all rows text to a string
-    int totlen = 0;
-    int i;
-    for (i = 0; i < E.num_rows; i++) {
-        totlen += E.row[i].size + 1;
+    mode_t mode = saver.mode;
+    struct stat targetStat;
+    int exists = (stat(target, &targetStat) == 0);
+    if (exists) {
+        mode = targetStat.st_mode & 07777;
     }
-    *buflen = totlen;
 
-    char* combinedStr = malloc(totlen);
-    char* rowItr = combinedStr;
-    for (i = 0; i < E.num_rows; i++) {
-        memcpy(rowItr, E.row[i].chars, E.row[i].size);
-        rowItr += E.row[i].size;
-        *rowItr = '\n';
-        ++rowItr;
+    char* slash = strrchr(target, '/');
+    int dirLength = slash ? slash - target + 1 : 0;
+    char* tmpPath = malloc(strlen(target) + 18);
+    sprintf(tmpPath, "%.*s.%s.kewetext-XXXXXX", dirLength, target, target + dirLength);
+
+    int result = -1;
+    int file = mkstemp(tmpPath);
+    if (file != -1) {
+        if (writePieces(file, saver.pieces, saver.count) == 0 && writeTail(file) == 0 && fsync(file) == 0 && fchmod(file, mode) == 0) {
+            if (exists) {
+                //Only root can keep another user's ownership, the file just belongs to the user otherwise
+                (void)fchown(file, targetStat.st_uid, targetStat.st_gid);
+            }
+            if (close(file) == 0 && rename(tmpPath, target) == 0) {
+                result = 0;
+            }
+        } else {
+            close(file);
+        }
+        if (result == -1) {
+            int error = errno;
+            unlink(tmpPath);
+            errno = error;
+        }
     }
 
-    return combinedStr;
+    if (result == 0) {
+        //Syncs the directory so the rename itself survives a crash
+        char* dir = dirLength ? strndup(target, dirLength) : strdup(".");
+        int dirFile = open(dir, O_RDONLY);
+        if (dirFile != -1) {
+            fsync(dirFile);
+            close(dirFile);
+        }
+        free(dir);
+    }
+    free(tmpPath);
+    free(target);
+    return result;
 }
 
-void editorOpen(char* filename) {
-    //Opens a file in the editor if argument added
-    free(E.filename);
-    E.filename = strdup(filename);
-
-    editorSelectSyntaxHighlight();
+void* saverThread(void* arg) {
+    //Writes the snapshot to disk and reports back when done
+    (void)arg;
+    int result = writeFileAtomic(saver.filename);
+    int error = errno;
+    if (saver.hashing && result == 0) {
+        //The undo history is only written for contents that were saved, the old one is kept otherwise
+        writeUndoHistory(&saver.history, saver.hash, saver.length);
+    }
+    pthread_mutex_lock(&saver.lock);
+    saver.result = result;
+    saver.error = error;
+    saver.done = 1;
+    pthread_cond_signal(&saver.finished);
+    pthread_mutex_unlock(&saver.lock);
+    editorWake();
+    return NULL;
+}
 
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        die("fopen");
+int editorSyncSaver() {
+    //Updates the save progress and finishes the save once written, returns 1 when anything changed
+    if (!E.saving) {
+        return 0;
     }
-    char* line = NULL;
-    size_t lineCap = 0;
-    ssize_t lineLen;
-    while ((lineLen = getline(&line, &lineCap, file)) != -1) {
-        //Adds all lines as text for a rows
-        while (lineLen > 0 && (line[lineLen - 1] == '\n' ||
-            line[lineLen - 1] == '\r' )) {
-            lineLen--;
+    pthread_mutex_lock(&saver.lock);
+    int done = saver.done;
+    int percent = saver.length ? saver.written * 100 / saver.length : 100;
+    pthread_mutex_unlock(&saver.lock);
+
+    if (!done) {
+        int changed = (percent != E.save_percent);
+        E.save_percent = percent;
+        return changed;
+    }
+
+    pthread_join(saver.thread, NULL);
+    pthread_mutex_destroy(&saver.lock);
+    pthread_cond_destroy(&saver.finished);
+    releaseRows(E.rows);
+    free(saver.pieces);
+    free(saver.filename);
+    E.saving = 0;
+    if (saver.hashing) {
+        commitUndoHistory(undo, &saver.history);
+    }
+    if (saver.result == 0) {
+        setStatusMessage("%lld bytes written to disk", saver.length);
+        //Edits made after the snapshot was taken are still unsaved
+        E.dirty -= saver.dirty;
+        if (E.dirty < 0) {
+            E.dirty = 0;
         }
-        editorInsertRow(E.num_rows, line, lineLen);
+    } else {
+        setStatusMessage("Can't save, IO error: %s", strerror(saver.error));
     }
+    return 1;
+}
 
-    free(line);
-    fclose(file);
-    E.dirty = 0;
+void editorFinishSaving() {
+    //Waits for a running save to finish
+    if (!E.saving) {
+        return;
+    }
+    pthread_mutex_lock(&saver.lock);
+    while (!saver.done) {
+        pthread_cond_wait(&saver.finished, &saver.lock);
+    }
+    pthread_mutex_unlock(&saver.lock);
+    editorSyncSaver();
 }
 
 void editorSaveFile(int newFile) {
     //Saves the current file or as a new file
+    if (E.saving) {
+        setStatusMessage("Already saving, wait for the save to finish");
+        return;
+    }
     if (E.filename == NULL || newFile) {
         E.filename = editorPrompt("Save file as: %s", NULL);
         if (E.filename == NULL) {
@@ -855,24 +2193,55 @@ void editorSaveFile(int newFile) {
         editorSelectSyntaxHighlight();
     }
 
-    int length;
-    char* buffer = editorRowsToString(&length);
-
-    int file = open(E.filename, O_RDWR | O_CREAT, 0644);
-    if (file != -1) {
-        if (ftruncate(file, length) != -1) {
-            if (write(file, buffer, length) == length) {
-                close(file);
-                free(buffer);
-                setStatusMessage("%d bytes written to disk", length);
-                E.dirty = 0;
-                return;
-            }
+    //Takes a snapshot of the rows and writes it on the save thread so editing can continue
+    saver.pieces = editorSnapshotRows(&saver.count, &saver.length);
+    saver.tail = NULL;
+    saver.tail_end = NULL;
+    if (E.loading) {
+        //The lines the loader found but were not added yet start the rest of the file
+        pthread_mutex_lock(&loader.lock);
+        saver.tail = loader.count ? loader.lines[loader.head].text : loader.next;
+        pthread_mutex_unlock(&loader.lock);
+        saver.tail_end = loader.end;
+        saver.length += saver.tail_end - saver.tail;
+    }
+    saver.filename = strdup(E.filename);
+    mode_t mask = umask(0);
+    umask(mask);
+    saver.mode = 0644 & ~mask;
+    saver.dirty = E.dirty;
+    saver.written = 0;
+    saver.hashing = 0;
+    saver.hash = UNDO_HASH_START;
+    if (config.undo_history) {
+        //The history of the file is written again along with it
+        char* path = editorFullPath(E.filename);
+        if (path) {
+            saveUndoHistory(undo, path, (long long) config.undo_history_size * 1024, &saver.history);
+            saver.hashing = 1;
+            free(path);
+        }
+    }
+    saver.done = 0;
+    freezeRows(E.rows);
+    pthread_mutex_init(&saver.lock, NULL);
+    pthread_cond_init(&saver.finished, NULL);
+    if (pthread_create(&saver.thread, NULL, saverThread, NULL) != 0) {
+        pthread_mutex_destroy(&saver.lock);
+        pthread_cond_destroy(&saver.finished);
+        int error = errno;
+        releaseRows(E.rows);
+        free(saver.pieces);
+        free(saver.filename);
+        if (saver.hashing) {
+            //Nothing was written, so the old history is kept
+            commitUndoHistory(undo, &saver.history);
         }
-        close(file);
+        setStatusMessage("Can't save, could not start saving: %s", strerror(error));
+        return;
     }
-    free(buffer);
-    setStatusMessage("Can't save, IO error: %s", strerror(errno));
+    E.saving = 1;
+    E.save_percent = 0;
 }
 
 //COPY
@@ -892,10 +2261,10 @@ int getSelectSize() {
         if (r == E.sel_endy) {
             end = E.sel_endx - 1;
         } else {
-            end = E.row[r].size - 1;
+            end = editorRow(r)->size - 1;
         }
         selectLen += end + 1 - start;
-        if (end == E.row[r].size - 1) {
+        if (r < E.num_rows && end == editorRow(r)->size - 1) {
             ++selectLen;
         }
     }
@@ -925,10 +2294,10 @@ void editorCopy() {
             end = E.sel_endx - 1;
         } else {
             //Minus 1 cause \0
-            end = E.row[r].size - 1;
+            end = editorRow(r)->size - 1;
         }
 
-        memcpy(rowItr, &E.row[r].chars[start], end + 1 - start);
+        memcpy(rowItr, &editorRow(r)->chars[start], end + 1 - start);
         rowItr += end + 1 - start;
         if (r == E.sel_endy) {
             *rowItr = '\0';
@@ -943,175 +2312,95 @@ void editorCopy() {
 
 //PASTE
 
+int editorInsertBlock(const char* text, int length) {
+    //Inserts a block of text at the cursor as it is, undone on its own, returns 0 when it could not be inserted
+    if (editorPastLoadedEnd()) {
+        return 0;
+    }
+    editorRecordInsert(GROUP_ALONE, text, length);
+    editorInsertString(E.cursory, E.cursorx, text, length, &E.cursory, &E.cursorx);
+    return 1;
+}
+
 void editorPaste() {
     //Pasts the contents of copied text at the cursor position
+    if (!E.copied_text) {
+        return;
+    }
     int copyLen = strlen(E.copied_text);
-    int i;
-    for (i = 0; i < copyLen; ++i) {
-        if (E.copied_text[i] == '\n') {
-            editorInsertNewLine(0);
-        } else {
-            editorInsertChar(E.copied_text[i]);
-        }
+    if (editorInsertBlock(E.copied_text, copyLen)) {
+        setStatusMessage("Pasted %d characters", copyLen);
     }
-
-    setStatusMessage("Pasted %d characters", copyLen);
 }
 
 //UNDO AND REDO
 
-void editorSwapStacks(Stack* source, Stack* dest) {
-    //Does the top operation of the source stack and stores the inverse of that in the dest stack
-    int firstChar = peek(source);
-    if (firstChar == -1) {
+int editorRecordLoaded(undoRecord* record) {
+    //Returns whether every row undoing a record touches is loaded, undoing an insert deletes the rows its text made
+    int last = record->y;
+    if (record->type != UNDO_DELETE && !record->single_line) {
+        const char* text = record->text;
+        const char* end = record->text + record->length;
+        while ((text = memchr(text, '\n', end - text))) {
+            ++last;
+            ++text;
+        }
+    }
+    return last < E.num_rows;
+}
+
+void editorSwapLogs(UndoLog* source, UndoLog* dest) {
+    //Undoes the top transaction of the source log and records its inverse as one transaction of the dest log
+    //Each record is undone with a single insert or delete of its whole text, last record first
+    undoRecord* records;
+    int count = topUndoTransaction(source, &records);
+    if (count == 0 && E.loading && source->history_check) {
+        //The history opened with the file is only undone from once the loader has hashed the file
+        editorFinishLoading();
+        count = topUndoTransaction(source, &records);
+    }
+    if (count == 0) {
         setStatusMessage("Nothing To Do");
         return;
     }
+    int i;
+    for (i = 0; E.loading && i < count; i++) {
+        //Edits past the rows loaded so far wait for the rest of the file
+        if (!editorRecordLoaded(&records[i])) {
+            editorFinishLoading();
+        }
+    }
     E.sel_startx = E.sel_endx = E.cursorx;
     E.sel_starty = E.sel_endy = E.cursory;
-    switch (firstChar) {
-        case BACKSPACE:
-        case BACKNEWROW:
-        case DELETE: {
-            //Flips delete and backspace characters in the dest stack and does these operations
-            int charItr;
-            while (pop(source, &charItr) == 1) {
-                if (firstChar == DELETE || charItr == DELETE) {
-                    moveCursor(ARROW_RIGHT);
-                    push(undo, DELETEINV);
-                }
-                if (E.cursorx > 0) {
-                    push(dest, E.row[E.cursory].chars[E.cursorx - 1]);
-                } else {
-                    push(dest, '\r');
-                }
-                editorDeleteChar();
-                if (peek(source) != firstChar) {
-                    break;
-                }
-            }
-            break;
-        }
-
-        case ARROW_LEFT:
-        case ARROW_RIGHT:
-        case ARROW_UP:
-        case ARROW_DOWN: {
-            //Flips arrow key operations and does these
-            int arrowItr;
-            while (pop(source, &arrowItr) == 1) {
-                pushArrows(dest, arrowItr);
-                moveCursor(arrowItr);
-                if ((peek(source) < 1000) || (peek(source) > 1003)) {
-                    break;
+    startUndoTransaction(dest, GROUP_ALONE);
+
+    for (i = count - 1; i >= 0; i--) {
+        undoRecord* record = &records[i];
+        switch (record->type) {
+            case UNDO_INSERT:
+            case UNDO_INSERT_FIRST:
+                addUndoRecord(dest, UNDO_DELETE, record->y, record->x, record->text, record->length,
+                    E.cursory, E.cursorx);
+                editorDeleteString(record->y, record->x, record->length, NULL);
+                if (record->type == UNDO_INSERT_FIRST && E.num_rows == 1 && editorRow(0)->size == 0) {
+                    editorDeleteRow(0);
                 }
-            }
-            break;
-        }
+                E.cursory = record->cursor_y;
+                E.cursorx = record->cursor_x;
+                break;
 
-        case ALT_UP:
-        case ALT_DOWN:
-        case ALT_LEFT:
-        case ALT_RIGHT: {
-            //Flips alt arrow keys and does these operations
-            int arrowItr2;
-            while (pop(source, &arrowItr2) == 1) {
-                pushArrows(dest, arrowItr2);
-                moveCursor(arrowItr2);
-                if ((peek(source) < 1004) || (peek(source) > 1007)) {
-                    break;
-                }
+            case UNDO_DELETE: {
+                int endY, endX;
+                addUndoRecord(dest, E.num_rows ? UNDO_INSERT : UNDO_INSERT_FIRST, record->y, record->x,
+                    record->text, record->length, E.cursory, E.cursorx);
+                editorInsertString(record->y, record->x, record->text, record->length, &endY, &endX);
+                E.cursory = record->cursor_y;
+                E.cursorx = record->cursor_x;
+                break;
             }
-            break;
         }
-
-        case PAGE_UP:
-        case PAGE_DOWN:
-        //Flips the page up and down keys, does these operations, and sends/recives x and y positions to keep
-        //track of
-            while (pop(source, &firstChar) == 1) {
-                if (dest == undo) {
-                    push(undoPageKeysY, E.cursory);
-                    push(undoPageKeysX, E.cursorx);
-                }
-                processPageKeys(dest, firstChar);
-                if (dest == redo) {
-                    pop(undoPageKeysY, &E.cursory);
-                    pop(undoPageKeysX, &E.cursorx);
-                }
-                if (peek(source) != firstChar) {
-                    break;
-                }
-            }
-        break;
-
-        case '\r':
-            //Reverses a return character and does this operation
-            while (pop(source, &firstChar) == 1) {
-                editorInsertNewLine(1);
-                if (peek(source) == DELETEINV) {
-                    push(dest, DELETE);
-                    pop(source, &firstChar);
-                    moveCursor(ARROW_LEFT);
-                } else {
-                    push(dest, BACKNEWROW);
-                }
-                if (config.auto_indent) {
-                    int i;
-                    for (i = 0; i < E.row[E.cursory].indent; ++i) {
-                        push(dest, BACKSPACE);
-                    }
-                }
-                if (peek(source) != '\r') {
-                    break;
-                }
-            }
-            break;
-
-        default:
-            //Inserts a character and reverses this operation to either a backspace or delete action
-            while (pop(source, &firstChar) == 1) {
-                editorInsertChar(firstChar);
-                if (peek(source) == DELETEINV) {
-                    push(dest, DELETE);
-                    pop(source, &firstChar);
-                    moveCursor(ARROW_LEFT);
-                } else {
-                    push(dest, BACKSPACE);
-                }
-                if ((peek(source) == '\r') || (peek(source) == 127) ||
-                    (peek(source) >= 1000)) {
-                    break;
-                }
-            }
-            break;
-    }
-}
-
-//APPEND BUFFER
-struct appendbuf {
-    //Buffer of chars to add to a row
-    char* buffer;
-    int length;
-};
-
-#define APPENDBUF_INIT { NULL, 0 }
-
-void appendBufAppend(struct appendbuf* b, const char* str, int length) {
-    //Adds chars to the append buffer
-    char* newBuffer = realloc(b->buffer, b->length + length);
-    if (newBuffer == NULL) {
-        return;
     }
-
-    memcpy(&newBuffer[b->length], str, length);
-    b->buffer = newBuffer;
-    b->length += length;
-}
-
-void appendBufFree(struct appendbuf* b) {
-    //Frees heap memory used in the append buffer
-    free(b->buffer);
+    dropUndoTransaction(source);
 }
 
 //OUTPUT
@@ -1120,7 +2409,7 @@ void scroll() {
     //Handles scrolling based on the cursor position
     E.renderx = 0;
     if (E.cursory < E.num_rows) {
-        E.renderx = rowCursorXToRenderX(&E.row[E.cursory], E.cursorx);
+        E.renderx = rowCursorXToRenderX(editorRow(E.cursory), E.cursorx);
     }
 
     if (E.cursory < E.rowoff) {
@@ -1137,48 +2426,89 @@ void scroll() {
     }
 }
 
-int drawSelect(struct appendbuf* abuf, int charx, int chary) {
-    //Add characters from start to not including end to selected chars
-    //Highlight selected characters in a color or inverse (All selecting should do)
+void selectedColumns(erow* row, int fileRow, int* start, int* end) {
+    //Works out the render columns of a row that are selected, from start to not including end
+    *start = *end = 0;
     if (E.sel_startx == E.sel_endx && E.sel_starty == E.sel_endy) {
-        return 0;
+        return;
     }
-    if (((E.sel_starty < chary) && (chary < E.sel_endy)) || //Middle
-        ((E.sel_starty == chary) && (chary == E.sel_endy) && (E.sel_startx <= charx) && (charx < E.sel_endx)) || //Same start/end row
-        ((E.sel_starty == chary) && (chary != E.sel_endy) && (E.sel_startx <= charx)) || //Start row
-        ((chary == E.sel_endy) && (E.sel_starty != chary) && (charx < E.sel_endx))) {//End row
-        appendBufAppend(abuf, "\x1b[7m", 4);
-        return 1;
+    if (fileRow < E.sel_starty || fileRow > E.sel_endy) {
+        return;
     }
-
-    return 0;
-}
-
-void drawColor(struct appendbuf* abuf, int color) {
-    //Sets the text color
-    char buf[16];
-    int clen;
-    if (config.use_256_colors) {
-        clen = snprintf(buf, sizeof(buf), "\x1b[38;5;%dm", color);
-    } else {
-        clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
+    int from = (fileRow == E.sel_starty) ? E.sel_startx : 0;
+    int to = (fileRow == E.sel_endy) ? E.sel_endx : row->size;
+    if (from > row->size) {
+        from = row->size;
+    }
+    if (to > row->size) {
+        to = row->size;
     }
-    appendBufAppend(abuf, buf, clen);
+    *start = rowCursorXToRenderX(row, from);
+    *end = rowCursorXToRenderX(row, to);
 }
 
-void drawPadding(struct appendbuf* abuf, int length) {
-    //Draws padding on empty lines to center a string of length length (from above)
+int drawPadding(Screen* screen, int y, int length) {
+    //Draws padding on empty lines to center a string of length length (from above), returns where the string starts
     int padding = (E.screen_cols - length) / 2;
+    int x = 0;
     if (padding) {
-        appendBufAppend(abuf, "-)", 2);
+        x = screenWrite(screen, y, x, "-)", 2, SCREEN_DEFAULT, 0);
         padding -= 2;
     }
-    while (padding--) {
-        appendBufAppend(abuf, " ", 1);
+    return x + padding;
+}
+
+void drawRowText(Screen* screen, int y, erow* row, int spanCount, int fileRow, int rowLen) {
+    //Draws the visible part of a row one run at a time, a run ends at the edge of a span or the find match
+    int x = E.coloff;
+    int end = E.coloff + rowLen;
+    int span = 0;
+    int spanStart = 0;
+    int lastColor = SCREEN_DEFAULT;
+    int selStart, selEnd;
+    selectedColumns(row, fileRow, &selStart, &selEnd);
+    while (x < end) {
+        while (span < spanCount && spanStart + row->spans[span].length <= x) {
+            spanStart += row->spans[span].length;
+            span++;
+        }
+        int type = HL_NORMAL;
+        int runEnd = end;
+        if (span < spanCount) {
+            type = row->spans[span].hl;
+            runEnd = spanStart + row->spans[span].length;
+        }
+        if (fileRow == E.find_row) {
+            //The find match is drawn over any spans it covers
+            int findEnd = E.find_start + E.find_length;
+            if (E.find_start <= x && x < findEnd) {
+                type = HL_MATCH;
+                runEnd = findEnd;
+            } else if (x < E.find_start && E.find_start < runEnd) {
+                runEnd = E.find_start;
+            }
+        }
+        if (runEnd > end) {
+            runEnd = end;
+        }
+        int color = syntaxToColor(type);
+        for (; x < runEnd; x++) {
+            char c = row->render[x];
+            if (iscntrl(c)) {
+                //Adds special control characters to the screen
+                char sym = (c <= 26) ? '@' + c : '?';
+                screenPut(screen, y, x - E.coloff, sym, lastColor, ATTR_INVERSE);
+            } else {
+                //Selected characters are drawn inverse
+                int attr = (selStart <= x && x < selEnd) ? ATTR_INVERSE : 0;
+                screenPut(screen, y, x - E.coloff, c, color, attr);
+                lastColor = color;
+            }
+        }
     }
 }
 
-void drawRows(struct appendbuf* abuf) {
+void drawRows(Screen* screen) {
     //Draws all rows in the editor
     int i;
     for (i = 0; i < E.screen_rows; ++i) {
@@ -1192,140 +2522,135 @@ void drawRows(struct appendbuf* abuf) {
                 if (welcomLength > E.screen_cols) {
                     welcomLength = E.screen_cols;
                 }
-                drawPadding(abuf, welcomLength);
-
-                appendBufAppend(abuf, welcome, welcomLength);
+                int x = drawPadding(screen, i, welcomLength);
+                screenWrite(screen, i, x, welcome, welcomLength, SCREEN_DEFAULT, 0);
             } else {
                 //Empty lines after the end of a file are represented by this
-                appendBufAppend(abuf, "-)", 2);
+                screenWrite(screen, i, 0, "-)", 2, SCREEN_DEFAULT, 0);
             }
         } else {
-            int rowLen = E.row[fileRow].rsize - E.coloff;
+            //Rows too far past the last checkpoint keep their last colors until the highlighter gets to them
+            erow* row;
+            int spanCount = 0;
+            if (editorSyntaxReady(fileRow)) {
+                row = editorHighlightRow(fileRow);
+                spanCount = row->span_count;
+            } else {
+                row = editorPrepareRow(fileRow);
+                if (row->hl_start != -1 && row->hl_generation == E.hl_generation) {
+                    spanCount = row->span_count;
+                }
+                E.hl_target = E.rowoff + E.screen_rows;
+            }
+            int rowLen = row->rsize - E.coloff;
             if (rowLen < 0) {
                 rowLen = 0;
             }
             if (rowLen > E.screen_cols) {
                 rowLen = E.screen_cols;
             }
-            
-            char* c = &E.row[fileRow].render[E.coloff];
-            unsigned char* hl = &E.row[fileRow].highlight[E.coloff];
-            int currentColor = -1;
-            int j;
-            for (j = 0; j < rowLen; ++j) {
-
-                if (iscntrl(c[j])) {
-                    //Adds special control characters to the screen
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    appendBufAppend(abuf, "\x1b[7m", 4);
-                    appendBufAppend(abuf, &sym, 1);
-                    appendBufAppend(abuf, "\x1b[m", 3);
-                    if (currentColor != -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", currentColor);
-                        appendBufAppend(abuf, buf, clen);
-                    }
-                } else {
-                    //Adds colored text based on the highlight array
-                    int color = syntaxToColor(hl[j]);
-                    if (color != currentColor) {
-                        currentColor = color;
-                        drawColor(abuf, color);
-                    }
-                    int isSelected = drawSelect(abuf, j, fileRow);
-                    appendBufAppend(abuf, &c[j], 1);
-                    if (isSelected) {
-                        appendBufAppend(abuf, "\x1b[m", 3);
-                        drawColor(abuf, color);
-                    }
-                }
-            }
-            appendBufAppend(abuf, "\x1b[39m", 5);
+            drawRowText(screen, i, row, spanCount, fileRow, rowLen);
         }
-        appendBufAppend(abuf, "\x1b[K", 3);
-        appendBufAppend(abuf, "\r\n", 2);
     }
 }
 
-void drawStatusBar(struct appendbuf* abuf) {
+void drawStatusBar(Screen* screen) {
     //Draws the status bar
-    appendBufAppend(abuf, "\x1b[7m", 4);
+    int y = E.screen_rows;
     char status[80], rightstatus[80];
     int length = snprintf(status, sizeof(status)," %.20s - Kewetext %s",
         E.filename ? E.filename : "[No Name]", E.dirty? "(Modified)" : "");
-    int rightlength = snprintf(rightstatus, sizeof(rightstatus), "%s | Line: %d/%d ",
-        E.syntax ? E.syntax->filetype : "no ft", E.cursory + 1, E.num_rows);
+    char loading[24] = "";
+    if (E.loading) {
+        snprintf(loading, sizeof(loading), " | Loading %d%%", E.load_percent);
+    } else if (E.saving) {
+        snprintf(loading, sizeof(loading), " | Saving %d%%", E.save_percent);
+    }
+    int rightlength = snprintf(rightstatus, sizeof(rightstatus), "%s%s | Line: %d/%d ",
+        E.syntax ? E.syntax->filetype : "no ft", loading, E.cursory + 1, E.num_rows);
     if (length > E.screen_cols) {
         length = E.screen_cols;
     }
-    appendBufAppend(abuf, status, length);
-
-    while (length < E.screen_cols) {
-        if (E.screen_cols - length == rightlength) {
-            appendBufAppend(abuf, rightstatus, rightlength);
-            break;
-        } else {
-            appendBufAppend(abuf, " ", 1);
-            ++length;
-        }
+    int x;
+    for (x = 0; x < E.screen_cols; x++) {
+        screenPut(screen, y, x, ' ', SCREEN_DEFAULT, ATTR_INVERSE);
+    }
+    screenWrite(screen, y, 0, status, length, SCREEN_DEFAULT, ATTR_INVERSE);
+    if (E.screen_cols - length >= rightlength) {
+        screenWrite(screen, y, E.screen_cols - rightlength, rightstatus, rightlength, SCREEN_DEFAULT, ATTR_INVERSE);
     }
-    appendBufAppend(abuf, "\x1b[m", 3);
-    appendBufAppend(abuf, "\r\n", 2);
 }
 
-void drawMessage(struct appendbuf* abuf) {
+void drawMessage(Screen* screen) {
     //Draws the message containing prompts and help
-    appendBufAppend(abuf, "\x1b[K", 3);
     int messageLength = strlen(E.status);
     if (messageLength > E.screen_cols) {
         messageLength = E.screen_cols;
     }
     if (messageLength && time(NULL) - E.status_time < 5) {
-        appendBufAppend(abuf, E.status, messageLength);
+        screenWrite(screen, E.screen_rows + 1, 0, E.status, messageLength, SCREEN_DEFAULT, 0);
     }
 }
 
-void drawHelp(struct appendbuf* abuf) {
+void drawHelp(Screen* screen) {
     //Draws the help window
-    char helpString[] = "\x1b[1m""Help Page\x1b[22m""\r\n\r\n"
-                        "Ctrl-G: Help, Ctrl-Q: Quit, Ctrl-S: Save, Ctrl-N: Save As,\r\n"
-                        "Ctrl-C: Copy, Ctrl-V: Paste, Ctrl-Z: Undo, Ctrl-R: Redo,\r\n"
-                        "Arrows, Page Up/Down, Home, and End to Move, Alt-Arrows to Select\r\n\r\n"
-                        "Press Ctrl-G to Exit Help";
-    int length = strlen(helpString);
-
-    appendBufAppend(abuf, "\x1b[2J", 4);
-    appendBufAppend(abuf, helpString, length);
+    char* helpLines[] = {
+        "Help Page",
+        "",
+        "Ctrl-G: Help, Ctrl-Q: Quit, Ctrl-S: Save, Ctrl-N: Save As,",
+        "Ctrl-C: Copy, Ctrl-V: Paste, Ctrl-Z: Undo, Ctrl-R: Redo,",
+        "Arrows, Page Up/Down, Home, and End to Move, Alt-Arrows to Select",
+        "",
+        "Press Ctrl-G to Exit Help"
+    };
+    int lines = sizeof(helpLines) / sizeof(helpLines[0]);
+    int i;
+    for (i = 0; i < lines; i++) {
+        screenWrite(screen, i, 0, helpLines[i], strlen(helpLines[i]), SCREEN_DEFAULT, i == 0 ? ATTR_BOLD : 0);
+    }
 }
 
 void refreshScreen() {
-    //Refreshes all drawn elements, cursor position, prints out append buffer 
+    //Draws every element into the screen, then prints out only what changed and the cursor position
+    editorSyncEvents();
+    clock_gettime(CLOCK_MONOTONIC, &events.last_frame);
     scroll();
 
-    //Remember the buff is seen in formating terminal text
-    struct appendbuf abuf = APPENDBUF_INIT;
-
-    appendBufAppend(&abuf, "\x1b[?25l", 6);
-    appendBufAppend(&abuf, "\x1b[H", 3);
-
+    clearScreen(E.screen);
     if (E.help) {
-        drawHelp(&abuf);
+        drawHelp(E.screen);
     } else {
+        drawRows(E.screen);
+        drawStatusBar(E.screen);
+        drawMessage(E.screen);
+    }
 
-        drawRows(&abuf);
-        drawStatusBar(&abuf);
-        drawMessage(&abuf);
+    //Remember the buff is seen in formating terminal text, it is kept between frames
+    struct appendbuf* abuf = &E.screen->output;
+    appendBufClear(abuf);
+
+    appendBufAppend(abuf, "\x1b[?25l", 6);
+    if (!E.help && E.shown_rowoff != -1 && E.coloff == E.shown_coloff) {
+        //Rows still on the screen after a scroll are moved by the terminal instead of being sent again
+        scrollScreen(E.screen, abuf, 0, E.screen_rows, E.rowoff - E.shown_rowoff);
+    }
+    flushScreen(E.screen, abuf);
+    E.shown_rowoff = E.help ? -1 : E.rowoff;
+    E.shown_coloff = E.coloff;
 
+    if (!E.help) {
         char buf[32];
         snprintf(buf, sizeof(buf), "\x1b[%d;%dH",
             (E.cursory - E.rowoff) + 1, (E.renderx - E.coloff) + 1);
-        appendBufAppend(&abuf, buf, strlen(buf));
+        appendBufAppend(abuf, buf, strlen(buf));
 
-        appendBufAppend(&abuf, "\x1b[?25h", 6);
+        appendBufAppend(abuf, "\x1b[?25h", 6);
     }
 
-    write(STDOUT_FILENO, abuf.buffer, abuf.length);
-    appendBufFree(&abuf);
+    write(STDOUT_FILENO, abuf->buffer, abuf->length);
+
+    //Starts on rows the screen could not highlight yet
+    editorQueueHighlight();
 }
 
 void setStatusMessage(const char* message, ...) {
@@ -1352,6 +2677,9 @@ char* editorPrompt(char* prompt, void (*callback) (char*, int)) {
         refreshScreen();
 
         int c = editorReadKey();
+        if (c == NO_KEY) {
+            continue;
+        }
         if (c == DELETE || c == BACKSPACE || c == CTRL('h')) {
             if (bufferLength != 0) {
                 buffer[--bufferLength] = '\0';
@@ -1371,6 +2699,20 @@ char* editorPrompt(char* prompt, void (*callback) (char*, int)) {
                 }
                 return buffer;
             }
+        } else if (c == PASTE) {
+            //Pasted text is typed into the answer up to its first line break
+            int i;
+            for (i = 0; i < input.paste_length && input.paste[i] != '\n'; i++) {
+                if (iscntrl(input.paste[i]) || (unsigned char) input.paste[i] >= 128) {
+                    continue;
+                }
+                if (bufferLength == bufferSize - 1) {
+                    bufferSize *= 2;
+                    buffer = realloc(buffer, bufferSize);
+                }
+                buffer[bufferLength++] = input.paste[i];
+                buffer[bufferLength] = '\0';
+            }
         } else if (!iscntrl(c) && c < 128) {
             if (bufferLength == bufferSize - 1) {
                 //When we are at the buffer size, double the space and realloc mem
@@ -1390,7 +2732,7 @@ char* editorPrompt(char* prompt, void (*callback) (char*, int)) {
 
 void moveCursor(int key) {
     //Moves the cursor based on user input
-    erow* row = (E.cursory >= E.num_rows) ? NULL : &E.row[E.cursory];
+    erow* row = (E.cursory >= E.num_rows) ? NULL : editorRow(E.cursory);
 
 
     switch (key) {
@@ -1406,7 +2748,7 @@ void moveCursor(int key) {
                 E.cursorx--;
             } else if (E.cursory > 0) {
                 E.cursory--;
-                E.cursorx = E.row[E.cursory].size;
+                E.cursorx = editorRow(E.cursory)->size;
             }
             break;
         case ARROW_DOWN:
@@ -1427,7 +2769,7 @@ void moveCursor(int key) {
 
     }
 
-    row = (E.cursory >= E.num_rows) ? NULL : &E.row[E.cursory];
+    row = (E.cursory >= E.num_rows) ? NULL : editorRow(E.cursory);
     int rowlen = row ? row->size : 0;
     if (E.cursorx > rowlen) {
         E.cursorx = rowlen;
@@ -1499,43 +2841,11 @@ void resetSelect(int* in_select) {
     E.sel_starty = E.sel_endy = E.cursory;
 }
 
-void pushArrows(Stack* stack, int key) {
-    //Adds the inverse of arrows and alt arrows to a stack
-    switch (key) {
-        case ARROW_UP:
-            push(stack, ARROW_DOWN);
-        break;
-        case ARROW_LEFT:
-            push(stack, ARROW_RIGHT);
-        break;
-        case ARROW_DOWN:
-            push(stack, ARROW_UP);
-        break;
-        case ARROW_RIGHT:
-            push(stack, ARROW_LEFT);
-        break;
-        case ALT_UP:
-            push(stack, ALT_DOWN);
-        break;
-        case ALT_LEFT:
-            push(stack, ALT_RIGHT);
-        break;
-        case ALT_DOWN:
-            push(stack, ALT_UP);
-        break;
-        case ALT_RIGHT:
-            push(stack, ALT_LEFT);
-        break;
-    }
-}
-
-void processPageKeys(Stack* stack, int c) {
+void processPageKeys(int c) {
     //Process the page up and page down keys
     if (c == PAGE_UP) {
-        push(stack, PAGE_DOWN);
         E.cursory = E.rowoff;
     } else {
-        push(stack, PAGE_UP);
         E.cursory = E.rowoff + E.screen_rows - 1;
         if (E.cursory >= E.num_rows) {
             E.cursory = E.num_rows;
@@ -1554,23 +2864,21 @@ void processKeyPress() {
     static int in_select = 0;
     static int sel_dir = 0;
     int c = editorReadKey();
+    if (c == NO_KEY) {
+        return;
+    }
 
     if (!E.help) {
         switch (c) {
             case '\r':
+            case '\n':
                 resetSelect(&in_select);
-                push(undo, BACKNEWROW);
-                if (config.auto_indent) {
-                    int i;
-                    for (i = 0; i < E.row[E.cursory].indent; ++i) {
-                        push(undo, BACKSPACE);
-                    }
-                }
-                editorInsertNewLine(0);
+                editorInsertNewLine();
             break;
 
             case CTRL_KEY('Q'):
                 //free(E.copied_text);
+                    editorFinishSaving();
                     if (E.dirty && quit_times > 0) {
                         setStatusMessage("Unsaved Changes. Press Ctrl-Q %d more times to quit",
                             quit_times);
@@ -1578,7 +2886,7 @@ void processKeyPress() {
                         return;
                     }
 
-            destroyStack(undo);
+            destroyUndoLog(undo);
             destroyConfig(&config);
             write(STDOUT_FILENO, "\x1b[2J", 4);
             write(STDOUT_FILENO, "\x1b[H", 3);
@@ -1603,40 +2911,38 @@ void processKeyPress() {
 
             case CTRL_KEY('V'):
                 resetSelect(&in_select);
-                size_t i = 0;
-                for (i = 0; i < strlen(E.copied_text); ++i) {
-                    push(undo, BACKSPACE);
-                }
                 editorPaste();
             break;
 
+            case PASTE:
+                //A paste from the terminal goes in as one block and is undone as one
+                resetSelect(&in_select);
+                if (editorInsertBlock(input.paste, input.paste_length)) {
+                    setStatusMessage("Pasted %d characters", input.paste_length);
+                }
+            break;
+
             case CTRL_KEY('G'):
                 E.help = 1;
             break;
 
             case CTRL_KEY('Z'):
-                editorSwapStacks(undo, redo);
+                editorSwapLogs(undo, redo);
             break;
 
             case CTRL_KEY('R'):
-                editorSwapStacks(redo, undo);
+                editorSwapLogs(redo, undo);
             break;
 
-            case HOME: {
-                int h;
-                for (h = 0; h < E.cursorx; ++h) {
-                    push(undo, ARROW_RIGHT);
-                }
+            case HOME:
+                breakUndoTransaction(undo);
                 E.cursorx = 0;
-                break;
-            }
+            break;
+
             case END:
                 if (E.cursory < E.num_rows) {
-                    int pos = E.cursorx;
-                    E.cursorx = E.row[E.cursory].size;
-                    for (; pos < E.cursorx; ++pos) {
-                        push(undo, ARROW_LEFT);
-                    }
+                    breakUndoTransaction(undo);
+                    E.cursorx = editorRow(E.cursory)->size;
                 }
             break;
 
@@ -1644,31 +2950,22 @@ void processKeyPress() {
             case CTRL_KEY('h'):
             case DELETE: {
                 int backAmt = getSelectSize();
-                if (c == DELETE && backAmt == 0) {
+                int forward = (c == DELETE && backAmt == 0);
+                if (forward) {
                     moveCursor(ARROW_RIGHT);
-                    push(undo, DELETEINV);
                 }
                 if (backAmt == 0) {
                     backAmt = 1;
                 }
-                int b;
-                for (b = 0; b < backAmt; ++b) {
-                    if (E.cursorx > 0) {
-                        push(undo, E.row[E.cursory].chars[E.cursorx - 1]);
-                    } else {
-                        push(undo, '\r');
-                    }
-                    editorDeleteChar();
-                }
+                editorDeleteChars(backAmt, forward);
                 resetSelect(&in_select);
             }
             break;
 
             case PAGE_UP:
             case PAGE_DOWN: {
-                push(undoPageKeysY, E.cursory);
-                push(undoPageKeysX, E.cursorx);
-                processPageKeys(undo, c);
+                breakUndoTransaction(undo);
+                processPageKeys(c);
                 break;
             }
 
@@ -1678,7 +2975,7 @@ void processKeyPress() {
             case ARROW_RIGHT:
                 moveCursor(c);
             resetSelect(&in_select);
-            pushArrows(undo, c);
+            breakUndoTransaction(undo);
             break;
 
             case ALT_RIGHT:
@@ -1686,7 +2983,7 @@ void processKeyPress() {
             case ALT_LEFT:
             case ALT_UP:
                 moveSelect(c, &in_select, &sel_dir);
-            pushArrows(undo, c);
+            breakUndoTransaction(undo);
             break;
 
             case CTRL_KEY('l'):
@@ -1696,11 +2993,10 @@ void processKeyPress() {
             default:
                 resetSelect(&in_select);
                 editorInsertChar(c);
-                push(undo, BACKSPACE);
             break;
         }
         if ((c != CTRL_KEY('G')) && (c != CTRL_KEY('R')) && (c != CTRL_KEY('Z'))) {
-            clear(redo);
+            clearUndoLog(redo);
         }
     } else {
         if (c == CTRL_KEY('G')) {
@@ -1727,12 +3023,25 @@ void startEditor() {
     E.num_rows = 0;
     E.dirty = 0;
     E.state = 0;
-    E.row = NULL;
+    E.rows = createRowBuffer(64);
+    E.map = NULL;
+    E.map_size = 0;
+    E.loading = 0;
+    E.load_percent = 0;
+    E.load_pending = 0;
+    E.saving = 0;
+    E.save_percent = 0;
     E.filename = NULL;
     E.copied_text = NULL;
     E.status[0] = '\0';
     E.status_time = 0;
     E.syntax = NULL;
+    E.hl_valid = E.hl_resume = E.hl_end = 0;
+    E.hl_target = 0;
+    E.hl_generation = 0;
+    E.hl_scratch = NULL;
+    E.hl_scratch_size = 0;
+    E.find_row = -1;
     E.help = 0;
 
     E.sel_startx = 0;
@@ -1743,33 +3052,26 @@ void startEditor() {
     if (getWindowSize(&E.screen_rows, &E.screen_cols) == -1) {
         die("getWindowSize");
     }
+    E.screen = createScreen(E.screen_rows, E.screen_cols);
+    E.shown_rowoff = -1;
+    E.shown_coloff = 0;
     E.screen_rows -= 2;
 }
 
-void setIndents() {
-    if (config.auto_indent != 1) {
-        return;
-    }
-    int i;
-    for (i = 0; i < E.num_rows; i++) {
-        erow* row = &E.row[i];
-        setRowIndent(row);
-    }
-}
-
 int main(int argc, char *argv[]) {
     //kewetext main code starts, and loops through editor functions
 
     enableRawMode();
     startEditor();
+    startEvents();
     loadConfig(&config);
-    undo = createStack(config.default_undo, config.inf_undo);
-    redo = createStack(config.default_undo, config.inf_undo);
-    undoPageKeysY = createStack(config.default_undo, config.inf_undo);
-    undoPageKeysX = createStack(config.default_undo, config.inf_undo);
+    setScreenColors(E.screen, config.use_256_colors);
+    //Only infinite undos have a memory budget, finite ones are already capped
+    long long undoBudget = config.inf_undo ? (long long) config.undo_memory * 1024 : 0;
+    undo = createUndoLog(config.default_undo, config.inf_undo, undoBudget);
+    redo = createUndoLog(config.default_undo, config.inf_undo, undoBudget);
     if (argc > 1) {
         editorOpen(argv[1]);
-        setIndents();
     }
 
     setStatusMessage("Press Ctrl-G for Help");
@@ -1777,6 +3079,10 @@ int main(int argc, char *argv[]) {
     while (1) {
         refreshScreen();
         processKeyPress();
+        while (editorWaitEvent(editorFrameTimeLeft())) {
+            //Keys that come in before the next frame are applied first and drawn together
+            processKeyPress();
+        }
     }
 
     return EXIT_SUCCESS;
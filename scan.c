@@ -0,0 +1,88 @@
+//
+// Created by kiron on 6/9/25.
+//
+
+#include "scan.h"
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SCAN_X86 1
+#include <immintrin.h>
+#else
+#define SCAN_X86 0
+#endif
+
+int scanBytesScalar(const char* text, int size, char first, char second) {
+    //Returns the position of the first byte equal to first or second, or size when there is none
+    int i;
+    for (i = 0; i < size; i++) {
+        if (text[i] == first || text[i] == second) {
+            return i;
+        }
+    }
+    return size;
+}
+
+#if SCAN_X86
+
+int scanBytesSse2(const char* text, int size, char first, char second) {
+    //Compares 16 bytes at a time, the tail shorter than a vector is left to the scalar loop
+    __m128i a = _mm_set1_epi8(first);
+    __m128i b = _mm_set1_epi8(second);
+    int i;
+    for (i = 0; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) &text[i]);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, a), _mm_cmpeq_epi8(chunk, b)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scanBytesScalar(&text[i], size - i, first, second);
+}
+
+__attribute__((target("avx2")))
+int scanBytesAvx2(const char* text, int size, char first, char second) {
+    //Compares 32 bytes at a time, the tail shorter than a vector is left to the scalar loop
+    __m256i a = _mm256_set1_epi8(first);
+    __m256i b = _mm256_set1_epi8(second);
+    int i;
+    for (i = 0; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i*) &text[i]);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, a),
+            _mm256_cmpeq_epi8(chunk, b)));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scanBytesScalar(&text[i], size - i, first, second);
+}
+
+#else
+
+int scanBytesSse2(const char* text, int size, char first, char second) {
+    //No SSE2 on this platform, the scalar loop is used
+    return scanBytesScalar(text, size, first, second);
+}
+
+int scanBytesAvx2(const char* text, int size, char first, char second) {
+    //No AVX2 on this platform, the scalar loop is used
+    return scanBytesScalar(text, size, first, second);
+}
+
+#endif
+
+int scanBytesDispatch(const char* text, int size, char first, char second) {
+    //Picks the fastest version the CPU supports on the first call and uses it from then on
+#if SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        scanBytes = scanBytesAvx2;
+    } else {
+        scanBytes = scanBytesSse2;
+    }
+#else
+    scanBytes = scanBytesScalar;
+#endif
+    return scanBytes(text, size, first, second);
+}
+
+int (*scanBytes)(const char* text, int size, char first, char second) = scanBytesDispatch;
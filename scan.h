@@ -0,0 +1,18 @@
+//
+// Created by kiron on 6/9/25.
+//
+
+#ifndef SCAN_H
+#define SCAN_H
+
+//Finds the first of two bytes in a run of text, used by the highlighter to skip over comments and strings
+//The SSE2 or AVX2 version is picked for the CPU the first time it is called, with a plain loop as the fallback
+
+extern int (*scanBytes)(const char* text, int size, char first, char second);
+
+int scanBytesScalar(const char* text, int size, char first, char second);
+int scanBytesSse2(const char* text, int size, char first, char second);
+int scanBytesAvx2(const char* text, int size, char first, char second);
+
+
+#endif //SCAN_H
@@ -0,0 +1,333 @@
+//
+// Created by kiron on 6/10/25.
+//
+
+#include "screen.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//APPEND BUFFER
+
+int appendBufReserve(struct appendbuf* b, int length) {
+    //Makes room for length more chars, the capacity is doubled so appending is only rarely a realloc
+    if (b->length + length <= b->capacity) {
+        return 1;
+    }
+    int newCapacity = b->capacity ? b->capacity : 4096;
+    while (newCapacity < b->length + length) {
+        newCapacity *= 2;
+    }
+    char* newBuffer = realloc(b->buffer, newCapacity);
+    if (newBuffer == NULL) {
+        return 0;
+    }
+    b->buffer = newBuffer;
+    b->capacity = newCapacity;
+    return 1;
+}
+
+void appendBufAppend(struct appendbuf* b, const char* str, int length) {
+    //Adds chars to the append buffer
+    if (!appendBufReserve(b, length)) {
+        return;
+    }
+
+    memcpy(&b->buffer[b->length], str, length);
+    b->length += length;
+}
+
+void appendBufByte(struct appendbuf* b, char c) {
+    //Adds a single char to the append buffer
+    if (b->length == b->capacity && !appendBufReserve(b, 1)) {
+        return;
+    }
+    b->buffer[b->length++] = c;
+}
+
+void appendBufClear(struct appendbuf* b) {
+    //Empties the append buffer but keeps its memory for the next use
+    b->length = 0;
+}
+
+void appendBufFree(struct appendbuf* b) {
+    //Frees heap memory used in the append buffer
+    free(b->buffer);
+    b->buffer = NULL;
+    b->length = 0;
+    b->capacity = 0;
+}
+
+//SCREEN
+
+Screen* createScreen(int rows, int cols) {
+    //Creates a blank screen, the first frame drawn on it is written whole
+    Screen* screen = malloc(sizeof(Screen));
+    if (!screen) {
+        exit(EXIT_FAILURE);
+    }
+    screen->rows = rows;
+    screen->cols = cols;
+    screen->cells = malloc(rows * cols * sizeof(screenCell));
+    screen->shown = malloc(rows * cols * sizeof(screenCell));
+    if (!screen->cells || !screen->shown) {
+        exit(EXIT_FAILURE);
+    }
+    screen->output.buffer = NULL;
+    screen->output.length = 0;
+    screen->output.capacity = 0;
+    setScreenColors(screen, 0);
+    clearScreen(screen);
+    invalidateScreen(screen);
+    return screen;
+}
+
+void destroyScreen(Screen* screen) {
+    //Deallocates both grids of the screen
+    free(screen->cells);
+    free(screen->shown);
+    appendBufFree(&screen->output);
+    free(screen);
+}
+
+void resizeScreen(Screen* screen, int rows, int cols) {
+    //Changes the size of both grids, what the terminal shows after a resize is unknown so the next frame is written whole
+    screenCell* cells = realloc(screen->cells, rows * cols * sizeof(screenCell));
+    if (cells) {
+        screen->cells = cells;
+    }
+    screenCell* shown = realloc(screen->shown, rows * cols * sizeof(screenCell));
+    if (shown) {
+        screen->shown = shown;
+    }
+    if (!cells || !shown) {
+        exit(EXIT_FAILURE);
+    }
+    screen->rows = rows;
+    screen->cols = cols;
+    clearScreen(screen);
+    invalidateScreen(screen);
+}
+
+void setScreenColors(Screen* screen, int use256Colors) {
+    //Makes the escape that sets each color, in either the 16 or the 256 color form
+    int color;
+    for (color = 0; color < SCREEN_COLORS; color++) {
+        int length;
+        if (use256Colors) {
+            length = snprintf(screen->sgr[color], sizeof(screen->sgr[color]), "\x1b[38;5;%dm", color);
+        } else {
+            length = snprintf(screen->sgr[color], sizeof(screen->sgr[color]), "\x1b[%dm", color);
+        }
+        screen->sgr_length[color] = length;
+    }
+    screen->use_256_colors = use256Colors;
+}
+
+void invalidateScreen(Screen* screen) {
+    //Forgets what the terminal shows, used when something else wrote to it
+    screen->valid = 0;
+}
+
+void clearScreen(Screen* screen) {
+    //Blanks the frame being drawn
+    int i;
+    for (i = 0; i < screen->rows * screen->cols; i++) {
+        screen->cells[i].ch = ' ';
+        screen->cells[i].attr = 0;
+        screen->cells[i].color = SCREEN_DEFAULT;
+    }
+}
+
+void screenPut(Screen* screen, int y, int x, char c, int color, int attr) {
+    //Sets one cell of the frame, cells off the screen are ignored
+    if (y < 0 || y >= screen->rows || x < 0 || x >= screen->cols) {
+        return;
+    }
+    screenCell* cell = &screen->cells[y * screen->cols + x];
+    cell->ch = c;
+    cell->attr = attr;
+    cell->color = color;
+}
+
+int screenWrite(Screen* screen, int y, int x, const char* str, int length, int color, int attr) {
+    //Sets a run of cells from a string, returns the column after the last one
+    int i;
+    for (i = 0; i < length; i++) {
+        screenPut(screen, y, x + i, str[i], color, attr);
+    }
+    return x + length;
+}
+
+int isBlankCell(screenCell* cell) {
+    //Returns 1 when a cell looks like a cleared one
+    return cell->ch == ' ' && cell->attr == 0 && cell->color == SCREEN_DEFAULT;
+}
+
+int isSameCell(screenCell* a, screenCell* b) {
+    //Returns 1 when two cells look the same on the terminal
+    return a->ch == b->ch && a->attr == b->attr && a->color == b->color;
+}
+
+int screenRowEnd(Screen* screen, screenCell* row) {
+    //Returns the column after the last cell of a row that is not blank
+    int end = screen->cols;
+    while (end > 0 && isBlankCell(&row[end - 1])) {
+        end--;
+    }
+    return end;
+}
+
+int isPlainRow(Screen* screen, screenCell* row) {
+    //Returns 1 when every cell of a row is a single byte character, so a column is one cell on the terminal
+    int x;
+    for (x = 0; x < screen->cols; x++) {
+        if ((unsigned char) row[x].ch >= 0x80) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void setScreenPen(Screen* screen, struct appendbuf* abuf, int color, int attr) {
+    //Changes the color and attributes the terminal writes with, only what differs is sent
+    if (color == screen->pen_color && attr == screen->pen_attr) {
+        return;
+    }
+    if (screen->pen_attr & ~attr) {
+        //Attributes can only be turned off all together
+        appendBufAppend(abuf, "\x1b[m", 3);
+        screen->pen_attr = 0;
+        screen->pen_color = SCREEN_DEFAULT;
+    }
+    if (attr & ~screen->pen_attr & ATTR_BOLD) {
+        appendBufAppend(abuf, "\x1b[1m", 4);
+    }
+    if (attr & ~screen->pen_attr & ATTR_INVERSE) {
+        appendBufAppend(abuf, "\x1b[7m", 4);
+    }
+    if (color != screen->pen_color) {
+        if (color == SCREEN_DEFAULT) {
+            appendBufAppend(abuf, "\x1b[39m", 5);
+        } else if (color >= 0 && color < SCREEN_COLORS) {
+            appendBufAppend(abuf, screen->sgr[color], screen->sgr_length[color]);
+        } else {
+            //Colors outside the table are still sent, just not from a made escape
+            char buf[24];
+            int clen = snprintf(buf, sizeof(buf), screen->use_256_colors ? "\x1b[38;5;%dm" : "\x1b[%dm", color);
+            appendBufAppend(abuf, buf, clen);
+        }
+    }
+    screen->pen_color = color;
+    screen->pen_attr = attr;
+}
+
+void moveScreenCursor(Screen* screen, struct appendbuf* abuf, int y, int x) {
+    //Moves the terminal cursor to a cell with the shortest way there
+    //A short gap on the same row is written over with the cells already in it when the color matches
+    if (screen->cursor_y == y && screen->cursor_x == x) {
+        return;
+    }
+    char buf[32];
+    int length;
+    if (screen->cursor_y == y && screen->cursor_x < x) {
+        screenCell* row = &screen->cells[y * screen->cols];
+        int gap = x - screen->cursor_x;
+        int i;
+        for (i = screen->cursor_x; gap <= 4 && i < x; i++) {
+            if (row[i].color != screen->pen_color || row[i].attr != screen->pen_attr) {
+                break;
+            }
+        }
+        if (gap <= 4 && i == x) {
+            for (i = screen->cursor_x; i < x; i++) {
+                appendBufByte(abuf, row[i].ch);
+            }
+            screen->cursor_x = x;
+            return;
+        }
+        length = snprintf(buf, sizeof(buf), "\x1b[%dC", gap);
+    } else if (x == 0 && screen->cursor_y != -1 && screen->cursor_y == y - 1) {
+        length = snprintf(buf, sizeof(buf), "\r\n");
+    } else {
+        length = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, x + 1);
+    }
+    appendBufAppend(abuf, buf, length);
+    screen->cursor_y = y;
+    screen->cursor_x = x;
+}
+
+void scrollScreen(Screen* screen, struct appendbuf* abuf, int top, int bottom, int lines) {
+    //Scrolls the rows from top to bottom, not included, by lines on the terminal and in what it shows
+    //Positive lines move the rows up, the rows scrolled in are blank and are drawn by the next flush
+    int count = abs(lines);
+    if (!screen->valid || lines == 0 || count >= bottom - top) {
+        return;
+    }
+    char buf[48];
+    int length = snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c\x1b[r",
+        top + 1, bottom, count, lines > 0 ? 'S' : 'T');
+    appendBufAppend(abuf, buf, length);
+
+    screenCell* first = &screen->shown[top * screen->cols];
+    int kept = (bottom - top - count) * screen->cols;
+    screenCell* blank;
+    if (lines > 0) {
+        memmove(first, &first[count * screen->cols], kept * sizeof(screenCell));
+        blank = &first[kept];
+    } else {
+        memmove(&first[count * screen->cols], first, kept * sizeof(screenCell));
+        blank = first;
+    }
+    int i;
+    for (i = 0; i < count * screen->cols; i++) {
+        blank[i].ch = ' ';
+        blank[i].attr = 0;
+        blank[i].color = SCREEN_DEFAULT;
+    }
+}
+
+void flushScreen(Screen* screen, struct appendbuf* abuf) {
+    //Writes the cells of the frame that differ from what the terminal shows, then the frame is what it shows
+    //Rows with multibyte characters do not line up with their cells, so they are written whole
+    screen->cursor_y = -1;
+    screen->pen_color = SCREEN_DEFAULT;
+    screen->pen_attr = 0;
+    int y;
+    for (y = 0; y < screen->rows; y++) {
+        screenCell* row = &screen->cells[y * screen->cols];
+        screenCell* shown = &screen->shown[y * screen->cols];
+        int plain = isPlainRow(screen, row);
+        int whole = !screen->valid || !plain || !isPlainRow(screen, shown);
+        if (whole && screen->valid && !memcmp(row, shown, screen->cols * sizeof(screenCell))) {
+            continue;
+        }
+        int end = screenRowEnd(screen, row);
+        if (whole) {
+            moveScreenCursor(screen, abuf, y, 0);
+        }
+        int x;
+        for (x = 0; x < end; x++) {
+            if (!whole && isSameCell(&row[x], &shown[x])) {
+                continue;
+            }
+            moveScreenCursor(screen, abuf, y, x);
+            setScreenPen(screen, abuf, row[x].color, row[x].attr);
+            appendBufByte(abuf, row[x].ch);
+            screen->cursor_x = x + 1;
+        }
+        if (end < screen->cols && (whole || screenRowEnd(screen, shown) > end)) {
+            //The rest of the row is cleared in one go
+            moveScreenCursor(screen, abuf, y, end);
+            setScreenPen(screen, abuf, SCREEN_DEFAULT, 0);
+            appendBufAppend(abuf, "\x1b[K", 3);
+        }
+        if (!plain) {
+            screen->cursor_y = -1;
+        }
+    }
+    setScreenPen(screen, abuf, SCREEN_DEFAULT, 0);
+    memcpy(screen->shown, screen->cells, screen->rows * screen->cols * sizeof(screenCell));
+    screen->valid = 1;
+}
@@ -0,0 +1,68 @@
+//
+// Created by kiron on 6/10/25.
+//
+
+#ifndef SCREEN_H
+#define SCREEN_H
+
+//Buffer of chars written to the terminal in one go
+//The buffer keeps its capacity when it is cleared, so it can be reused every frame without allocating
+
+struct appendbuf {
+    char* buffer;
+    int length;
+    int capacity;
+};
+
+#define APPENDBUF_INIT { NULL, 0, 0 }
+
+void appendBufAppend(struct appendbuf* b, const char* str, int length);
+void appendBufByte(struct appendbuf* b, char c);
+void appendBufClear(struct appendbuf* b);
+void appendBufFree(struct appendbuf* b);
+
+//Grid of cells the screen is drawn into, one cell for every column of every terminal row
+//A cell is one character with its color and attributes, a color of SCREEN_DEFAULT is the terminals own
+//The grid of what the terminal shows now is kept, and only the cells that changed are written each frame
+//The escape for every color is made once when the color mode is set, and output is the buffer every frame is written to
+
+#define SCREEN_DEFAULT -1
+#define SCREEN_COLORS 256
+
+enum screenAttribute {
+    ATTR_INVERSE = 1,
+    ATTR_BOLD = 2
+};
+
+typedef struct screenCell {
+    char ch;
+    unsigned char attr;
+    short color;
+} screenCell;
+
+typedef struct Screen {
+    int rows, cols;
+    screenCell* cells;
+    screenCell* shown;
+    int valid;
+    int cursor_y, cursor_x;
+    int pen_color, pen_attr;
+    char sgr[SCREEN_COLORS][12];
+    unsigned char sgr_length[SCREEN_COLORS];
+    int use_256_colors;
+    struct appendbuf output;
+} Screen;
+
+Screen* createScreen(int rows, int cols);
+void destroyScreen(Screen* screen);
+void resizeScreen(Screen* screen, int rows, int cols);
+void setScreenColors(Screen* screen, int use256Colors);
+void invalidateScreen(Screen* screen);
+void clearScreen(Screen* screen);
+void screenPut(Screen* screen, int y, int x, char c, int color, int attr);
+int screenWrite(Screen* screen, int y, int x, const char* str, int length, int color, int attr);
+void scrollScreen(Screen* screen, struct appendbuf* abuf, int top, int bottom, int lines);
+void flushScreen(Screen* screen, struct appendbuf* abuf);
+
+
+#endif //SCREEN_H
@@ -11,9 +11,16 @@
 Stack* createStack(int size, int canChange) {
     //Creates a new stack on the heap
     Stack* stack = malloc(sizeof(Stack));
-    stack->capacity = size;
-    stack->top = -1;
-    stack->data = (int*)malloc(size * 4);
+    if (!stack) {
+        exit(EXIT_FAILURE);
+    }
+    stack->capacity = size > 0 ? size : 1;
+    stack->bottom = 0;
+    stack->count = 0;
+    stack->data = (int*)malloc(stack->capacity * sizeof(int));
+    if (!stack->data) {
+        exit(EXIT_FAILURE);
+    }
     stack->can_change_size = canChange;
     return stack;
 }
@@ -24,52 +31,84 @@ void destroyStack(Stack* stack) {
     free(stack);
 }
 
+int stackIndex(Stack* stack, int position) {
+    //Returns where in data the item position places above the bottom is kept
+    int index = stack->bottom + position;
+    return index >= stack->capacity ? index - stack->capacity : index;
+}
+
 int push(Stack* stack, int keyAdded) {
-    //Adds a new element to the top of the stack, resizes if required / moves data if not
-    if (stack->top >= stack->capacity - 1) {
+    //Adds a new element to the top of the stack, resizes if required / drops the bottom element if not
+    if (stack->count == stack->capacity) {
         if (stack->can_change_size == 1) {
-            stack->data = (int*)realloc(stack->data, stack->capacity * 2 * 4);
-            stack->capacity *= 2;
+            stack->data = (int*)realloc(stack->data, stack->capacity * 2 * sizeof(int));
             if (!stack->data) {
                 exit(EXIT_FAILURE);
             }
+            //The items that wrapped around to the start move past the old end, so they follow on from the rest
+            memcpy(&stack->data[stack->capacity], stack->data, stack->bottom * sizeof(int));
+            stack->capacity *= 2;
         } else {
-            int* tmp = malloc(stack->capacity * 4);
-            memcpy(tmp, &stack->data[stack->capacity / 2 - 1], (stack->capacity * 2));
-            stack->top = stack->capacity / 2 - 1;
-            free(stack->data);
-            stack->data = tmp;
+            //The new element takes the place of the oldest one
+            stack->data[stack->bottom] = keyAdded;
+            stack->bottom = stackIndex(stack, 1);
+            return 1;
         }
     }
-    stack->data[++stack->top] = keyAdded;
+    stack->data[stackIndex(stack, stack->count++)] = keyAdded;
     return 1;
 }
 
 int pop(Stack* stack, int* keyRecived) {
     //Removes the top item on the stack
-    if (stack->top == -1) {
+    if (stack->count == 0) {
         return 0;
     }
-    *keyRecived = stack->data[stack->top];
-    --stack->top;
+    *keyRecived = stack->data[stackIndex(stack, --stack->count)];
     return 1;
 }
 
 int peek(Stack* stack) {
     //Returns the top item of the stack
-    if (stack->top == -1) {
+    if (stack->count == 0) {
         return -1;
     }
-    return stack->data[stack->top];
+    return stack->data[stackIndex(stack, stack->count - 1)];
+}
+
+int peekAt(Stack* stack, int position) {
+    //Returns the item position places above the bottom of the stack
+    if (position < 0 || position >= stack->count) {
+        return -1;
+    }
+    return stack->data[stackIndex(stack, position)];
+}
+
+int peekBottom(Stack* stack) {
+    //Returns the bottom item of the stack, the oldest one it still holds
+    if (stack->count == 0) {
+        return -1;
+    }
+    return stack->data[stack->bottom];
+}
+
+int popBottom(Stack* stack, int* keyRecived) {
+    //Removes the bottom item on the stack, the oldest one it holds
+    if (stack->count == 0) {
+        return 0;
+    }
+    *keyRecived = stack->data[stack->bottom];
+    stack->bottom = stackIndex(stack, 1);
+    --stack->count;
+    return 1;
 }
 
 int clear(Stack* stack) {
-    //Clears all elements on the stack
-    if (stack->top == -1) {
+    //Clears all elements on the stack, the memory is kept for the next ones
+    if (stack->count == 0) {
         return 0;
     }
-    free(stack->data);
-    stack->top = -1;
-    stack->data = malloc(stack->capacity * 4);
+    stack->bottom = 0;
+    stack->count = 0;
     return 1;
-}
\ No newline at end of file
+}
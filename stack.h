@@ -5,11 +5,13 @@
 #ifndef STACK_H
 #define STACK_H
 
-//Integer Stack Data Structure used to store the integer values of key presses
+//Integer Stack Data Structure, the undo log uses it to store the index of the first record of each transaction
+//Items are kept in a ring, bottom is where the oldest one is in data and count is how many there are
+//A stack that can not change size drops its oldest item when one is pushed while it is full
 
 typedef struct Stack {
     int* data;
-    int top, capacity, can_change_size;
+    int bottom, count, capacity, can_change_size;
 } Stack;
 
 Stack* createStack(int size, int canChange);
@@ -17,6 +19,9 @@ void destroyStack(Stack* stack);
 int push(Stack* stack, int keyAdded);
 int pop(Stack* stack, int* keyRecived);
 int peek(Stack* stack);
+int peekAt(Stack* stack, int position);
+int peekBottom(Stack* stack);
+int popBottom(Stack* stack, int* keyRecived);
 int clear(Stack* stack);
 
 
@@ -0,0 +1,149 @@
+//
+// Benchmark of scanBytes, run with make bench
+//
+
+#include "../scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_SIZE (20 << 20)
+#define BENCH_RUNS 5
+
+struct scanVersion {
+    const char* name;
+    int (*scan)(const char* text, int size, char first, char second);
+};
+
+//Byte pairs the highlighter scans for: the end of a block comment, the end of a string, and two bytes
+//that never show up so the whole text is scanned
+static const char pairs[][2] = { {'*', '*'}, {'"', '\\'}, {'\x01', '\x02'} };
+
+char* readText(const char* path, int* size) {
+    //Reads the file and repeats it until the text is BENCH_SIZE bytes
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    rewind(file);
+    if (length <= 0) {
+        fprintf(stderr, "%s is empty\n", path);
+        exit(EXIT_FAILURE);
+    }
+    char* text = malloc(BENCH_SIZE);
+    if (!text || fread(text, 1, length < BENCH_SIZE ? length : BENCH_SIZE, file) == 0) {
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    int at;
+    for (at = length; at < BENCH_SIZE; at += length) {
+        memcpy(&text[at], text, at + length <= BENCH_SIZE ? length : BENCH_SIZE - at);
+    }
+    *size = BENCH_SIZE;
+    return text;
+}
+
+long long scanLines(struct scanVersion* version, const char* text, int size, const char* pair) {
+    //Scans every line for a pair the way the highlighter does, restarting after each byte found
+    //Returns a sum of the positions found, which has to be the same for every version
+    long long sum = 0;
+    int start = 0;
+    while (start < size) {
+        const char* newLine = memchr(&text[start], '\n', size - start);
+        int end = newLine ? newLine - text : size;
+        int at = start;
+        while (at < end) {
+            at += version->scan(&text[at], end - at, pair[0], pair[1]);
+            sum += at;
+            at++;
+        }
+        start = end + 1;
+    }
+    return sum;
+}
+
+double seconds() {
+    //Returns a monotonic time in seconds
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char* argv[]) {
+    int size;
+    char* text = readText(argc > 1 ? argv[1] : "main.c", &size);
+
+    struct scanVersion versions[3] = {
+        { "scalar", scanBytesScalar },
+        { "sse2", scanBytesSse2 },
+        { "avx2", scanBytesAvx2 }
+    };
+    int count = 3;
+#if defined(__GNUC__) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("No AVX2 on this CPU, it is left out\n");
+        count = 2;
+    }
+#endif
+
+    //Every version has to find the same bytes, checked at each length so the vector tails are covered too
+    int failed = 0;
+    int v, p, length, start;
+    for (v = 1; v < count; v++) {
+        for (p = 0; p < 3; p++) {
+            for (length = 0; length <= 100; length++) {
+                for (start = 0; start < 4096; start += 61) {
+                    int expected = scanBytesScalar(&text[start], length, pairs[p][0], pairs[p][1]);
+                    int got = versions[v].scan(&text[start], length, pairs[p][0], pairs[p][1]);
+                    if (got != expected) {
+                        printf("%s found %d instead of %d at %d with length %d\n", versions[v].name, got,
+                            expected, start, length);
+                        failed = 1;
+                    }
+                }
+            }
+            if (scanLines(&versions[v], text, size, pairs[p]) != scanLines(&versions[0], text, size, pairs[p])) {
+                printf("%s does not match the scalar scan on the whole text\n", versions[v].name);
+                failed = 1;
+            }
+        }
+    }
+    if (failed) {
+        return EXIT_FAILURE;
+    }
+    printf("All versions find the same bytes\n\n");
+
+    //Best of BENCH_RUNS in MB/s, per line as in the highlighter and over the text as one run
+    printf("%-8s %12s %12s %12s %12s\n", "version", "comment", "string", "plain", "whole");
+    for (v = 0; v < count; v++) {
+        printf("%-8s", versions[v].name);
+        for (p = 0; p < 4; p++) {
+            double best = 0;
+            int run;
+            for (run = 0; run < BENCH_RUNS; run++) {
+                double begin = seconds();
+                volatile long long sink;
+                if (p < 3) {
+                    sink = scanLines(&versions[v], text, size, pairs[p]);
+                } else {
+                    sink = versions[v].scan(text, size, pairs[2][0], pairs[2][1]);
+                }
+                (void)sink;
+                double rate = size / (seconds() - begin) / (1 << 20);
+                if (rate > best) {
+                    best = rate;
+                }
+            }
+            printf(" %12.0f", best);
+        }
+        printf("\n");
+    }
+    free(text);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,175 @@
+//
+// Tests of the stack, run with make test
+//
+
+#include "../stack.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define THROUGHPUT_OPS 100000000
+
+static int failures = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+        failures++; \
+    } \
+} while (0)
+
+void testFiniteWraparound() {
+    //A full finite stack drops only its oldest item on each push, and keeps the order of the rest for peekAt
+    Stack* stack = createStack(4, 0);
+    int i, item;
+    for (i = 0; i < 10; i++) {
+        push(stack, i);
+        CHECK(peek(stack) == i);
+        CHECK(peekBottom(stack) == (i < 4 ? 0 : i - 3));
+    }
+    CHECK(stack->count == 4);
+    for (i = 0; i < 4; i++) {
+        CHECK(peekAt(stack, i) == 6 + i);
+    }
+    CHECK(peekAt(stack, 4) == -1);
+    for (i = 9; i >= 6; i--) {
+        CHECK(pop(stack, &item) && item == i);
+    }
+    CHECK(!pop(stack, &item));
+    CHECK(peek(stack) == -1 && peekBottom(stack) == -1);
+    destroyStack(stack);
+}
+
+void testPopBottom() {
+    //Items come off the bottom oldest first, also once the ring has wrapped
+    Stack* stack = createStack(3, 0);
+    int i, item;
+    for (i = 0; i < 5; i++) {
+        push(stack, i);
+    }
+    CHECK(popBottom(stack, &item) && item == 2);
+    CHECK(peekBottom(stack) == 3);
+    push(stack, 5);
+    push(stack, 6);
+    CHECK(peekBottom(stack) == 4 && peek(stack) == 6);
+    CHECK(popBottom(stack, &item) && item == 4);
+    CHECK(popBottom(stack, &item) && item == 5);
+    CHECK(popBottom(stack, &item) && item == 6);
+    CHECK(!popBottom(stack, &item));
+    destroyStack(stack);
+}
+
+void testWrapPoint() {
+    //Items on both sides of where the ring wraps are found in order, and a full wrapped stack pops from its bottom
+    Stack* stack = createStack(4, 0);
+    int i, item;
+    for (i = 0; i < 6; i++) {
+        push(stack, i);
+    }
+    CHECK(stack->count == 4 && stack->bottom == 2);
+    CHECK(peekAt(stack, 1) == 3);
+    CHECK(peekAt(stack, 2) == 4);
+    CHECK(peekAt(stack, 3) == 5);
+    CHECK(popBottom(stack, &item) && item == 2);
+    CHECK(stack->count == 3 && stack->bottom == 3);
+    CHECK(popBottom(stack, &item) && item == 3);
+    CHECK(stack->count == 2 && stack->bottom == 0);
+    CHECK(peekAt(stack, 0) == 4 && peekAt(stack, 1) == 5 && peekAt(stack, 2) == -1);
+    destroyStack(stack);
+}
+
+void testEmptied() {
+    //A stack emptied by pops from either end has no items left and takes new ones at its bottom
+    Stack* stack = createStack(3, 0);
+    int i, item;
+    for (i = 0; i < 4; i++) {
+        push(stack, i);
+    }
+    CHECK(pop(stack, &item) && item == 3);
+    CHECK(popBottom(stack, &item) && item == 1);
+    CHECK(pop(stack, &item) && item == 2);
+    CHECK(stack->count == 0);
+    CHECK(stack->bottom >= 0 && stack->bottom < stack->capacity);
+    CHECK(!pop(stack, &item) && !popBottom(stack, &item));
+    CHECK(peek(stack) == -1 && peekBottom(stack) == -1 && peekAt(stack, 0) == -1);
+    push(stack, 8);
+    CHECK(stack->count == 1 && peekAt(stack, 0) == 8);
+    CHECK(peek(stack) == 8 && peekBottom(stack) == 8);
+    destroyStack(stack);
+}
+
+void testGrowing() {
+    //A stack that can change size keeps every item, also when it grows after its bottom moved
+    Stack* stack = createStack(2, 1);
+    int i, item;
+    push(stack, 0);
+    push(stack, 1);
+    CHECK(popBottom(stack, &item) && item == 0);
+    for (i = 2; i < 100; i++) {
+        push(stack, i);
+    }
+    CHECK(stack->count == 99);
+    CHECK(peekBottom(stack) == 1);
+    for (i = 99; i >= 1; i--) {
+        CHECK(pop(stack, &item) && item == i);
+    }
+    destroyStack(stack);
+}
+
+void testClear() {
+    //Clearing empties the stack and it can be used again straight away
+    Stack* stack = createStack(4, 0);
+    int i, item;
+    CHECK(!clear(stack));
+    for (i = 0; i < 6; i++) {
+        push(stack, i);
+    }
+    CHECK(clear(stack));
+    CHECK(peek(stack) == -1 && !pop(stack, &item));
+    push(stack, 7);
+    CHECK(peek(stack) == 7 && peekBottom(stack) == 7);
+    destroyStack(stack);
+}
+
+double seconds() {
+    //Returns a monotonic time in seconds
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void reportThroughput(int canChange) {
+    //Pushes THROUGHPUT_OPS items, popping every third, the way undo pushes and pops transactions
+    Stack* stack = createStack(200, canChange);
+    int i, item;
+    volatile int sink = 0;
+    double begin = seconds();
+    for (i = 0; i < THROUGHPUT_OPS; i++) {
+        push(stack, i);
+        if (i % 3 == 0 && pop(stack, &item)) {
+            sink += item;
+        }
+    }
+    double elapsed = seconds() - begin;
+    printf("%s push/pop: %.0f million operations per second\n", canChange ? "growing" : "finite",
+        THROUGHPUT_OPS * 4 / 3 / elapsed / 1e6);
+    destroyStack(stack);
+}
+
+int main() {
+    testFiniteWraparound();
+    testPopBottom();
+    testWrapPoint();
+    testEmptied();
+    testGrowing();
+    testClear();
+    if (failures) {
+        printf("%d stack checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("All stack checks passed\n");
+    reportThroughput(0);
+    reportThroughput(1);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,746 @@
+//
+// Created by kiron on 6/14/25.
+//
+
+#include "undo.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//A spill file starts with a struct undoHistoryHeader and transactions are appended after it as they are spilled
+//Each one is a struct undoSpillHeader holding the offset of the one spilled before it, then its records, each
+//a struct undoSpillRecord followed by its text. spill_top is the last one, so they are read back newest first
+//A history is a spill file kept in the state directory for each file. Saving writes a new one on the saver thread
+//with the transactions in memory and the ones spilled before them, newest first, up to a budget, and renames it
+//over the old one. Its header holds the hash of what was saved, so it is only undone from when the file still
+//holds that. The history opened with a file is used as the spill file, what its header points at is kept as is
+
+//Fields of a record as they are written in the spill file, the text of the record follows them
+struct undoSpillRecord {
+    int type;
+    int group;
+    int y, x;
+    int cursor_y, cursor_x;
+    int single_line;
+    int length;
+};
+
+//Start of a transaction in the spill file, followed by size bytes of records
+struct undoSpillHeader {
+    long long previous;
+    int start;
+    int count;
+    long long size;
+};
+
+//Bytes being laid out to be written to the spill file in one go, count is how many transactions they hold
+struct undoPack {
+    char* data;
+    long long length;
+    long long capacity;
+    int count;
+};
+
+//Start of every spill file, for a history it says which file contents the transactions it points at undo from
+struct undoHistoryHeader {
+    char magic[8];
+    unsigned long long hash;
+    long long size;
+    long long top;
+    long long end;
+};
+
+#define UNDO_HISTORY_MAGIC "kewundo2"
+#define UNDO_SPILL_START ((long long) sizeof(struct undoHistoryHeader))
+
+//UNDO LOG
+
+char* undoStatePath(const char* name) {
+    //Returns the path of a file in the kewetext state directory, or NULL when the directory can not be made
+    //The directory is $XDG_STATE_HOME/kewetext, or ~/.local/state/kewetext when that is not set
+    const char* stateDir = getenv("XDG_STATE_HOME");
+    const char* subDir = "/kewetext/";
+    if (!stateDir || stateDir[0] != '/') {
+        stateDir = getenv("HOME");
+        if (!stateDir) {
+            struct passwd* user = getpwuid(getuid());
+            if (!user) {
+                return NULL;
+            }
+            stateDir = user->pw_dir;
+        }
+        subDir = "/.local/state/kewetext/";
+    }
+    int length = strlen(stateDir) + strlen(subDir) + strlen(name) + 1;
+    char* path = malloc(length);
+    if (!path) {
+        exit(EXIT_FAILURE);
+    }
+    snprintf(path, length, "%s%s%s", stateDir, subDir, name);
+
+    //Makes each directory on the way that is missing
+    char* slash;
+    for (slash = strchr(&path[1], '/'); slash; slash = strchr(&slash[1], '/')) {
+        *slash = '\0';
+        int made = mkdir(path, 0700) == 0 || errno == EEXIST;
+        *slash = '/';
+        if (!made) {
+            free(path);
+            return NULL;
+        }
+    }
+    return path;
+}
+
+unsigned long long undoHash(unsigned long long hash, const char* data, long long length) {
+    //Adds data to a 64 bit FNV-1a hash, so text written in pieces hashes the same as all of it at once
+    long long i;
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+char* undoHistoryName(const char* path) {
+    //Returns the name of the history file kept in the state directory for the file at path
+    char* name = malloc(32);
+    if (!name) {
+        exit(EXIT_FAILURE);
+    }
+    snprintf(name, 32, "history-%016llx", undoHash(UNDO_HASH_START, path, strlen(path)));
+    return name;
+}
+
+UndoLog* createUndoLog(int size, int canChange, long long budget) {
+    //Creates an empty undo log on the heap that keeps size transactions, or grows when it can change size
+    //Records over budget bytes are moved to the spill file, which is only made once something is spilled
+    UndoLog* log = malloc(sizeof(UndoLog));
+    if (!log) {
+        exit(EXIT_FAILURE);
+    }
+    log->records = NULL;
+    log->first = 0;
+    log->count = 0;
+    log->capacity = 0;
+    log->group = 0;
+    log->transactions = createStack(size, canChange);
+    log->bytes = 0;
+    log->budget = budget;
+    log->spill_fd = -1;
+    log->spill_top = -1;
+    log->spill_end = UNDO_SPILL_START;
+    log->spill_fixed = UNDO_SPILL_START;
+    log->spill_keep = UNDO_SPILL_START;
+    log->history_content = NULL;
+    log->history_size = 0;
+    log->history_hash = 0;
+    log->history_check = 0;
+    log->history_link = -1;
+    log->saving = 0;
+    return log;
+}
+
+void freeUndoRecord(UndoLog* log, undoRecord* record) {
+    //Frees the text of a record and takes the memory it used off the log
+    log->bytes -= sizeof(undoRecord) + record->capacity;
+    free(record->text);
+}
+
+void forgetUndoRecords(UndoLog* log, int count) {
+    //Frees the oldest count records of the log
+    int i;
+    for (i = 0; i < count; i++) {
+        freeUndoRecord(log, &log->records[i]);
+    }
+    if (log->count > count) {
+        memmove(log->records, &log->records[count], (log->count - count) * sizeof(undoRecord));
+    }
+    log->count -= count;
+    log->first += count;
+}
+
+void destroyUndoLog(UndoLog* log) {
+    //Deallocates the undo log and all of its records
+    clearUndoLog(log);
+    free(log->records);
+    destroyStack(log->transactions);
+    if (log->spill_fd != -1) {
+        close(log->spill_fd);
+    }
+    free(log);
+}
+
+void clearUndoLog(UndoLog* log) {
+    //Forgets every transaction in the log
+    forgetUndoRecords(log, log->count);
+    log->first = 0;
+    log->group = 0;
+    clear(log->transactions);
+    if (log->spill_end > log->spill_keep) {
+        //Gives back the disk space of the spilled transactions, the file is kept open for the next ones
+        //What the header of an opened history points at is left as it is
+        ftruncate(log->spill_fd, log->spill_keep);
+    }
+    log->spill_top = -1;
+    log->spill_end = log->spill_keep;
+}
+
+undoRecord* lastUndoRecord(UndoLog* log) {
+    //Returns the last record of the top transaction, or NULL when it has none yet
+    int start = peek(log->transactions);
+    if (start == -1 || start >= log->first + log->count) {
+        return NULL;
+    }
+    return &log->records[log->count - 1];
+}
+
+undoRecord* newUndoRecord(UndoLog* log) {
+    //Adds a blank record to the end of the log
+    if (log->count == log->capacity) {
+        int newCapacity = log->capacity ? log->capacity * 2 : 64;
+        undoRecord* records = realloc(log->records, newCapacity * sizeof(undoRecord));
+        if (!records) {
+            exit(EXIT_FAILURE);
+        }
+        log->records = records;
+        log->capacity = newCapacity;
+    }
+    undoRecord* record = &log->records[log->count++];
+    memset(record, 0, sizeof(undoRecord));
+    record->group = log->group;
+    log->bytes += sizeof(undoRecord);
+    return record;
+}
+
+void joinUndoText(UndoLog* log, undoRecord* record, const char* text, int length, int atStart) {
+    //Grows the text of a record with text typed or deleted right next to it
+    if (record->length + length > record->capacity) {
+        int newCapacity = record->capacity ? record->capacity : 16;
+        while (newCapacity < record->length + length) {
+            newCapacity *= 2;
+        }
+        record->text = realloc(record->text, newCapacity);
+        if (!record->text) {
+            exit(EXIT_FAILURE);
+        }
+        log->bytes += newCapacity - record->capacity;
+        record->capacity = newCapacity;
+    }
+    if (atStart) {
+        memmove(&record->text[length], record->text, record->length);
+        memcpy(record->text, text, length);
+    } else {
+        memcpy(&record->text[record->length], text, length);
+    }
+    record->length += length;
+}
+
+//SPILL FILE
+
+int openUndoSpill(UndoLog* log) {
+    //Makes the spill file the first time it is needed, it is unlinked right away so it is gone once the editor exits
+    if (log->spill_fd != -1) {
+        return 1;
+    }
+    char* path = undoStatePath("undo-XXXXXX");
+    if (!path) {
+        return 0;
+    }
+    log->spill_fd = mkstemp(path);
+    if (log->spill_fd != -1) {
+        unlink(path);
+    }
+    free(path);
+    return log->spill_fd != -1;
+}
+
+int writeUndoFile(int file, const void* data, long long length, long long at) {
+    //Writes data to a file at an offset, returns 0 when it could not be written
+    const char* bytes = data;
+    while (length > 0) {
+        ssize_t written = pwrite(file, bytes, length, at);
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return 0;
+        }
+        bytes += written;
+        length -= written;
+        at += written;
+    }
+    return 1;
+}
+
+int readUndoFile(int file, void* data, long long length, long long at) {
+    //Reads data from a file at an offset, returns 0 when it could not be read
+    char* bytes = data;
+    while (length > 0) {
+        ssize_t got = pread(file, bytes, length, at);
+        if (got == -1 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return 0;
+        }
+        bytes += got;
+        length -= got;
+        at += got;
+    }
+    return 1;
+}
+
+void packUndoBytes(struct undoPack* pack, const void* data, long long length) {
+    //Adds bytes to the end of a pack
+    if (pack->length + length > pack->capacity) {
+        long long newCapacity = pack->capacity ? pack->capacity : 4096;
+        while (newCapacity < pack->length + length) {
+            newCapacity *= 2;
+        }
+        pack->data = realloc(pack->data, newCapacity);
+        if (!pack->data) {
+            exit(EXIT_FAILURE);
+        }
+        pack->capacity = newCapacity;
+    }
+    memcpy(&pack->data[pack->length], data, length);
+    pack->length += length;
+}
+
+void packUndoTransaction(UndoLog* log, struct undoPack* pack, int start, int end, long long previous) {
+    //Adds the transaction of the records from start to end to a pack the way it is laid out in the spill file
+    struct undoSpillHeader header = {previous, start, end - start, 0};
+    long long headerAt = pack->length;
+    packUndoBytes(pack, &header, sizeof(header));
+    int i;
+    for (i = start - log->first; i < end - log->first; i++) {
+        undoRecord* record = &log->records[i];
+        struct undoSpillRecord fields = {record->type, record->group, record->y, record->x,
+            record->cursor_y, record->cursor_x, record->single_line, record->length};
+        packUndoBytes(pack, &fields, sizeof(fields));
+        packUndoBytes(pack, record->text, record->length);
+    }
+    header.size = pack->length - headerAt - sizeof(header);
+    memcpy(&pack->data[headerAt], &header, sizeof(header));
+    pack->count++;
+}
+
+void settleUndoHistory(UndoLog* log, int matched) {
+    //Takes the result of checking the history opened with the file against the contents it was opened with
+    //A history that does not end at those contents is dropped, along with the link to it of a transaction spilled since
+    if (!log->history_check) {
+        return;
+    }
+    log->history_check = 0;
+    if (!matched) {
+        struct undoHistoryHeader header;
+        memset(&header, 0, sizeof(header));
+        writeUndoFile(log->spill_fd, &header, sizeof(header), 0);
+        if (log->spill_top < log->spill_fixed) {
+            log->spill_top = -1;
+        }
+        if (log->history_link != -1) {
+            long long none = -1;
+            writeUndoFile(log->spill_fd, &none, sizeof(none), log->history_link);
+        }
+    }
+    log->history_link = -1;
+}
+
+void spillUndoTransaction(UndoLog* log) {
+    //Moves the oldest transaction in memory to the end of the spill file with one write
+    //A transaction that can not be written is forgotten, like the oldest ones of a finite log
+    int start;
+    popBottom(log->transactions, &start);
+    int end = peekBottom(log->transactions);
+    if (end == -1) {
+        end = log->first + log->count;
+    }
+    if (start > log->first) {
+        forgetUndoRecords(log, start - log->first);
+    }
+    int count = end - start;
+    if (openUndoSpill(log)) {
+        struct undoPack pack = {NULL, 0, 0, 0};
+        packUndoTransaction(log, &pack, start, end, log->spill_top);
+        int written = writeUndoFile(log->spill_fd, pack.data, pack.length, log->spill_end);
+        free(pack.data);
+        if (written) {
+            if (log->history_check && log->spill_top != -1 && log->spill_top < log->spill_fixed) {
+                //It links to the history opened with the file, which is not checked yet
+                log->history_link = log->spill_end;
+            }
+            log->spill_top = log->spill_end;
+            log->spill_end += pack.length;
+            forgetUndoRecords(log, count);
+            return;
+        }
+    }
+    //Older transactions can not be undone past the one that is lost, so they are forgotten too
+    log->spill_top = -1;
+    log->spill_end = log->spill_keep;
+    forgetUndoRecords(log, count);
+}
+
+int loadUndoTransaction(UndoLog* log) {
+    //Reads the last transaction spilled back into memory as the only one there, returns 0 when there is none
+    //It is always the last one in a spill file, so its space is used again by the next transaction spilled
+    //unless it is below spill_keep. The history opened with the file is only read once it was checked
+    if (log->spill_top == -1 || (log->history_check && log->spill_top < log->spill_fixed)) {
+        return 0;
+    }
+    struct undoSpillHeader header;
+    long long at = log->spill_top;
+    char* body = NULL;
+    if (!readUndoFile(log->spill_fd, &header, sizeof(header), at) || header.count < 0 || header.size < 0 ||
+        !(body = malloc(header.size + 1)) || !readUndoFile(log->spill_fd, body, header.size, at + sizeof(header))) {
+        free(body);
+        log->spill_top = -1;
+        return 0;
+    }
+    if (at >= log->spill_keep) {
+        log->spill_end = at;
+    }
+    if (at == log->history_link) {
+        log->history_link = -1;
+    }
+    log->spill_top = header.previous;
+    forgetUndoRecords(log, log->count);
+    log->first = header.start;
+    log->group = 0;
+    long long used = 0;
+    int i;
+    for (i = 0; i < header.count; i++) {
+        struct undoSpillRecord fields;
+        if (used + (long long) sizeof(fields) > header.size) {
+            break;
+        }
+        memcpy(&fields, &body[used], sizeof(fields));
+        used += sizeof(fields);
+        if (fields.length < 0 || used + fields.length > header.size) {
+            break;
+        }
+        undoRecord* record = newUndoRecord(log);
+        record->type = fields.type;
+        record->group = fields.group;
+        record->y = fields.y;
+        record->x = fields.x;
+        record->cursor_y = fields.cursor_y;
+        record->cursor_x = fields.cursor_x;
+        record->single_line = fields.single_line;
+        record->length = fields.length;
+        if (record->length > 0) {
+            record->text = malloc(record->length);
+            if (!record->text) {
+                exit(EXIT_FAILURE);
+            }
+            memcpy(record->text, &body[used], record->length);
+            record->capacity = record->length;
+            log->bytes += record->length;
+            used += record->length;
+        }
+    }
+    free(body);
+    push(log->transactions, header.start);
+    return 1;
+}
+
+//HISTORY FILE
+
+void openUndoHistory(UndoLog* log, const char* path, const char* content, long long size) {
+    //Takes up the history kept for the file at path when it was last saved with the same size as the spill file
+    //Only the header is read here, it is not undone from until checkUndoHistory gets the hash of the contents
+    //content is what the file held when it was opened and has to stay readable while the log is used
+    if (log->spill_fd != -1) {
+        return;
+    }
+    char* name = undoHistoryName(path);
+    char* statePath = undoStatePath(name);
+    free(name);
+    int file = statePath ? open(statePath, O_RDWR) : -1;
+    free(statePath);
+    struct undoHistoryHeader header;
+    if (file == -1 || !readUndoFile(file, &header, sizeof(header), 0) ||
+        memcmp(header.magic, UNDO_HISTORY_MAGIC, 8) || header.size != size || header.top == -1 ||
+        header.end < UNDO_SPILL_START) {
+        if (file != -1) {
+            close(file);
+        }
+        return;
+    }
+    log->spill_fd = file;
+    log->spill_top = header.top;
+    log->spill_end = header.end;
+    log->spill_fixed = header.end;
+    log->spill_keep = header.end;
+    log->history_content = content;
+    log->history_size = size;
+    log->history_hash = header.hash;
+    log->history_check = 1;
+}
+
+void checkUndoHistory(UndoLog* log, unsigned long long hash) {
+    //Checks the history opened with the file against the hash of the contents it was opened with
+    settleUndoHistory(log, hash == log->history_hash);
+}
+
+void saveUndoHistory(UndoLog* log, const char* path, long long budget, undoHistoryWrite* write) {
+    //Packs the transactions in memory, newest first, for the saver thread to write a new history of the file at path
+    //The spill file is not written over until commitUndoHistory is called once the save is done
+    //A budget of 0 keeps every transaction
+    //The top transaction is written as it is now, so later edits go into a new one
+    log->group = 0;
+
+    struct undoPack pack = {NULL, 0, 0, 0};
+    int position;
+    for (position = log->transactions->count - 1; position >= 0; position--) {
+        int start = peekAt(log->transactions, position);
+        int end = position + 1 < log->transactions->count ? peekAt(log->transactions, position + 1) :
+            log->first + log->count;
+        if (start < log->first || start == end) {
+            continue;
+        }
+        packUndoTransaction(log, &pack, start, end, -1);
+    }
+
+    write->name = undoHistoryName(path);
+    write->file = log->spill_fd;
+    write->top = log->spill_top;
+    write->fixed = log->spill_fixed;
+    write->data = pack.data;
+    write->length = pack.length;
+    write->budget = budget;
+    write->limit = log->transactions->can_change_size ? 0 : log->transactions->capacity;
+    write->check = log->history_check;
+    write->content = log->history_content;
+    write->size = log->history_size;
+    write->hash = log->history_hash;
+    write->matched = 1;
+    write->written = 0;
+    log->saving = 1;
+    log->spill_keep = log->spill_end;
+}
+
+int placeUndoTransaction(undoHistoryWrite* write, struct undoPack* out, struct undoSpillHeader* header,
+    const char* body, long long* last) {
+    //Adds a transaction to the transactions of a new history, linked to the one placed after it
+    //Returns 0 when it does not fit in the budget or the limit, last is set to where it starts in the file
+    long long length = sizeof(*header) + header->size;
+    if ((write->budget > 0 && out->length + length > write->budget) ||
+        (write->limit > 0 && out->count == write->limit)) {
+        return 0;
+    }
+    struct undoSpillHeader linked = *header;
+    linked.previous = UNDO_SPILL_START + out->length + length;
+    *last = UNDO_SPILL_START + out->length;
+    packUndoBytes(out, &linked, sizeof(linked));
+    packUndoBytes(out, body, header->size);
+    out->count++;
+    return 1;
+}
+
+void writeUndoHistory(undoHistoryWrite* write, unsigned long long hash, long long size) {
+    //Writes the history of a file saved with size bytes with hash to a temporary file and renames it over the old one
+    //Runs on the saver thread once the file is saved, the log itself is not touched
+    //The transactions packed are placed first and then the ones spilled before them are copied, until the budget
+    //or the limit of a finite log is used up, so the history only holds what can be undone from the saved contents and the oldest are dropped
+    if (write->check) {
+        write->matched = undoHash(UNDO_HASH_START, write->content, write->size) == write->hash;
+    }
+    struct undoPack out = {NULL, 0, 0, 0};
+    long long last = -1;
+    int full = 0;
+    long long used = 0;
+    while (!full && used + (long long) sizeof(struct undoSpillHeader) <= write->length) {
+        struct undoSpillHeader header;
+        memcpy(&header, &write->data[used], sizeof(header));
+        used += sizeof(header);
+        full = !placeUndoTransaction(write, &out, &header, &write->data[used], &last);
+        used += header.size;
+    }
+    //The spilled transactions go on from the oldest in memory, up to the history opened with the file when it does
+    //not hold any more
+    long long from = write->top;
+    char* body = NULL;
+    while (!full && from != -1 && (write->matched || from >= write->fixed)) {
+        struct undoSpillHeader header;
+        if (!readUndoFile(write->file, &header, sizeof(header), from) || header.size < 0 ||
+            !(body = realloc(body, header.size + 1)) || !readUndoFile(write->file, body, header.size,
+            from + sizeof(header))) {
+            //Older transactions can not be undone past one that can not be read
+            break;
+        }
+        full = !placeUndoTransaction(write, &out, &header, body, &last);
+        from = header.previous;
+    }
+    free(body);
+    if (last != -1) {
+        long long none = -1;
+        memcpy(&out.data[last - UNDO_SPILL_START], &none, sizeof(none));
+    }
+
+    struct undoHistoryHeader header;
+    memcpy(header.magic, UNDO_HISTORY_MAGIC, 8);
+    header.hash = hash;
+    header.size = size;
+    header.top = last == -1 ? -1 : UNDO_SPILL_START;
+    header.end = UNDO_SPILL_START + out.length;
+
+    write->written = 0;
+    char* path = undoStatePath(write->name);
+    char* tmpPath = path ? malloc(strlen(path) + 8) : NULL;
+    if (tmpPath) {
+        sprintf(tmpPath, "%s-XXXXXX", path);
+        int file = mkstemp(tmpPath);
+        if (file != -1) {
+            int written = writeUndoFile(file, &header, sizeof(header), 0) &&
+                writeUndoFile(file, out.data, out.length, UNDO_SPILL_START) && fdatasync(file) == 0;
+            written = close(file) == 0 && written;
+            write->written = written && rename(tmpPath, path) == 0;
+            if (!write->written) {
+                unlink(tmpPath);
+            }
+        }
+    }
+    free(tmpPath);
+    free(path);
+    free(out.data);
+}
+
+void commitUndoHistory(UndoLog* log, undoHistoryWrite* write) {
+    //Finishes a history write once the save is done, the spill file can be written over again
+    if (!log->saving) {
+        return;
+    }
+    if (write->written && write->check) {
+        //The saver found out whether the history opened with the file still holds
+        settleUndoHistory(log, write->matched);
+    }
+    free(write->data);
+    free(write->name);
+    write->data = NULL;
+    write->name = NULL;
+    log->saving = 0;
+    log->spill_keep = log->spill_fixed;
+}
+
+//TRANSACTIONS
+
+void startUndoTransaction(UndoLog* log, int group) {
+    //Starts a transaction for the records added next
+    //A group that is not 0 keeps adding to the top transaction while it was started with the same group
+    int start = peek(log->transactions);
+    if (start != -1 && start == log->first + log->count) {
+        //The top transaction is still empty, so it is used instead
+        log->group = group;
+        return;
+    }
+    if (group != 0 && start != -1 && log->group == group) {
+        return;
+    }
+    if (!log->transactions->can_change_size && log->transactions->count == log->transactions->capacity) {
+        //The oldest transaction is dropped, so the ones spilled before it can not be undone any more
+        log->spill_top = -1;
+    }
+    push(log->transactions, log->first + log->count);
+    log->group = group;
+
+    //A finite stack drops its oldest transaction once full, its records go once they are half the log
+    //so the records left are not moved down on every transaction
+    int oldest = peekBottom(log->transactions);
+    if (oldest - log->first > log->count / 2) {
+        forgetUndoRecords(log, oldest - log->first);
+    }
+
+    if (log->budget && log->bytes > log->budget) {
+        //Spills down to three quarters of the budget, so the next transactions do not spill one at a time
+        while (log->bytes > log->budget / 4 * 3 && peekBottom(log->transactions) != peek(log->transactions)) {
+            spillUndoTransaction(log);
+        }
+    }
+}
+
+void breakUndoTransaction(UndoLog* log) {
+    //Keeps the next edit out of the top transaction even when it has the same group, like after the cursor moved
+    log->group = 0;
+}
+
+void addUndoRecord(UndoLog* log, int type, int y, int x, const char* text, int length, int cursorY, int cursorX) {
+    //Adds an insert or delete of text at a position to the top transaction
+    //Text on one line that continues the last record is joined onto it, so a run of typing is one record
+    if (length <= 0) {
+        return;
+    }
+    int singleLine = !memchr(text, '\n', length);
+    undoRecord* last = lastUndoRecord(log);
+    int lastType = last ? last->type : -1;
+    if (lastType == UNDO_INSERT_FIRST) {
+        //Typing on after the insert that made the first row joins it
+        lastType = UNDO_INSERT;
+    }
+    if (last && lastType == type && last->single_line && singleLine && last->y == y) {
+        if (type == UNDO_INSERT && last->x + last->length == x) {
+            joinUndoText(log, last, text, length, 0);
+            return;
+        }
+        if (type == UNDO_DELETE && last->x == x) {
+            //Deleted in front of the cursor
+            joinUndoText(log, last, text, length, 0);
+            return;
+        }
+        if (type == UNDO_DELETE && x + length == last->x) {
+            //Deleted behind the cursor
+            joinUndoText(log, last, text, length, 1);
+            last->x = x;
+            return;
+        }
+    }
+
+    undoRecord* record = newUndoRecord(log);
+    record->type = type;
+    record->y = y;
+    record->x = x;
+    record->cursor_y = cursorY;
+    record->cursor_x = cursorX;
+    record->single_line = singleLine;
+    joinUndoText(log, record, text, length, 0);
+}
+
+int topUndoTransaction(UndoLog* log, undoRecord** records) {
+    //Points records at the records of the top transaction and returns how many it has, 0 when there is nothing to undo
+    //Transactions that were started without any records are skipped, once memory has none the spill file is read
+    int start = peek(log->transactions);
+    while ((start != -1 && start == log->first + log->count) ||
+        ((start == -1 || start < log->first) && loadUndoTransaction(log))) {
+        if (start != -1 && start == log->first + log->count) {
+            pop(log->transactions, &start);
+        }
+        start = peek(log->transactions);
+    }
+    if (start == -1 || start < log->first) {
+        return 0;
+    }
+    *records = &log->records[start - log->first];
+    return log->first + log->count - start;
+}
+
+void dropUndoTransaction(UndoLog* log) {
+    //Frees the top transaction once it was undone
+    int start;
+    if (!pop(log->transactions, &start) || start < log->first) {
+        return;
+    }
+    int i;
+    for (i = start - log->first; i < log->count; i++) {
+        freeUndoRecord(log, &log->records[i]);
+    }
+    log->count = start - log->first;
+    log->group = 0;
+}
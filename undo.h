@@ -0,0 +1,97 @@
+//
+// Created by kiron on 6/14/25.
+//
+
+#ifndef UNDO_H
+#define UNDO_H
+
+#include "stack.h"
+
+//Log of edits that can be undone, stored as inserts and deletes of text grouped into transactions
+//Moving the cursor is not recorded, undoing an edit puts the cursor back where it was before the edit
+//Past the memory budget the oldest transactions move to a spill file, a history keeps them in the state
+//directory so they can be undone next session, undo.c describes the file
+
+#define UNDO_HASH_START 0xcbf29ce484222325ULL
+
+//An insert into a file with no rows makes the first row, undoing it removes that row too
+enum undoType {
+    UNDO_INSERT,
+    UNDO_DELETE,
+    UNDO_INSERT_FIRST
+};
+
+typedef struct undoRecord {
+    int type;
+    int group;
+    int y, x;
+    int cursor_y, cursor_x;
+    int single_line;
+    int length;
+    int capacity;
+    char* text;
+} undoRecord;
+
+//Transactions packed by saveUndoHistory for the saver thread to write into a new history file with the name
+//The spilled ones older than them are copied from file starting at top, up to budget bytes of history and
+//limit transactions when it is not 0
+//When check is set the history opened with the file, below fixed, was not checked yet, so the saver hashes the
+//contents it was opened with and compares them to hash
+typedef struct undoHistoryWrite {
+    char* name;
+    int file;
+    long long top;
+    long long fixed;
+    char* data;
+    long long length;
+    long long budget;
+    int limit;
+    int check;
+    const char* content;
+    long long size;
+    unsigned long long hash;
+    int matched;
+    int written;
+} undoHistoryWrite;
+
+//Records are indexed from the start of the log, first is the oldest one still in memory, and the transactions
+//stack holds the index of the first record of each transaction, so a finite stack forgets the oldest by itself
+//The spill file is never written over below spill_keep, which is spill_fixed unless a save is reading it
+typedef struct UndoLog {
+    undoRecord* records;
+    int first, count, capacity;
+    int group;
+    Stack* transactions;
+    long long bytes;
+    long long budget;
+    int spill_fd;
+    long long spill_top;
+    long long spill_end;
+    long long spill_fixed;
+    long long spill_keep;
+    const char* history_content;
+    long long history_size;
+    unsigned long long history_hash;
+    int history_check;
+    long long history_link;
+    int saving;
+} UndoLog;
+
+char* undoStatePath(const char* name);
+unsigned long long undoHash(unsigned long long hash, const char* data, long long length);
+UndoLog* createUndoLog(int size, int canChange, long long budget);
+void destroyUndoLog(UndoLog* log);
+void clearUndoLog(UndoLog* log);
+void startUndoTransaction(UndoLog* log, int group);
+void breakUndoTransaction(UndoLog* log);
+void addUndoRecord(UndoLog* log, int type, int y, int x, const char* text, int length, int cursorY, int cursorX);
+int topUndoTransaction(UndoLog* log, undoRecord** records);
+void dropUndoTransaction(UndoLog* log);
+void openUndoHistory(UndoLog* log, const char* path, const char* content, long long size);
+void checkUndoHistory(UndoLog* log, unsigned long long hash);
+void saveUndoHistory(UndoLog* log, const char* path, long long budget, undoHistoryWrite* write);
+void writeUndoHistory(undoHistoryWrite* write, unsigned long long hash, long long size);
+void commitUndoHistory(UndoLog* log, undoHistoryWrite* write);
+
+
+#endif //UNDO_H